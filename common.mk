@@ -5,9 +5,9 @@ WARNING_FLAGS	= -Wall -Werror -Wno-deprecated-declarations -Wno-unused
 OPT_FLAGS		= -O2 -g
 
 CFLAGS			= -std=c99   $(OPT_FLAGS) $(WARNING_FLAGS)
-CXXFLAGS		= -std=c++1z $(OPT_FLAGS) $(WARNING_FLAGS)
+CXXFLAGS		= -std=c++1z $(OPT_FLAGS) $(ARCH_FLAGS) $(WARNING_FLAGS)
 CPPFLAGS		= -DHAVE_CONFIG_H -I../include -I../lib/libdispatch -I../lib/libpwq/include $(BOOST_INCLUDE)
-LDFLAGS			= $(LIBDISPATCH_LIBS) $(BOOST_LIBS)
+LDFLAGS			= $(LIBDISPATCH_LIBS) $(BOOST_LIBS) $(ZLIB_LIBS)
 
 
 %.o: %.cc
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_BCF_READER_HH
+#define VCF2MULTIALIGN_BCF_READER_HH
+
+#include <functional>
+#include <string>
+#include <vcf2multialign/bgzf_reader.hh>
+#include <vcf2multialign/vcf_reader.hh>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	// Check the magic number of the decompressed BGZF file. Does not change the file offset.
+	bool is_bcf(int const fd);
+
+
+	// Read BCF2 records into the same variant objects as vcf_reader.
+	// The strings point to the reader's buffer or to the header dictionaries.
+	// Line numbers are those of the records in the corresponding VCF file.
+	class bcf_reader final : public vcf_reader
+	{
+	protected:
+		bgzf_reader							m_reader;
+		std::vector <char>					m_buffer;
+		std::vector <std::string>			m_contig_names;		// By index in the header.
+		bgzf_reader::virtual_offset_type	m_first_variant_offset{0};
+		std::size_t							m_len{0};
+		std::size_t							m_pos{0};			// End of the complete records.
+		std::size_t							m_gt_key{SIZE_MAX};	// Index of GT in the string dictionary.
+		bool								m_at_eof{false};
+
+	protected:
+		bool parse_records(callback_fn const &cb) override;
+		bool parse_records(batch_builder &builder) override { return parse_records(callback_fn(std::ref(builder))); }
+		void read_bytes(char *dst, std::size_t const len);
+		void read_dictionaries(std::string const &header_line, std::map <std::string, std::size_t> &strings);
+		void decode_shared(char const *data, char const *end);
+		void decode_samples(char const *data, char const *end, std::size_t const format_count, std::size_t const sample_count);
+
+		template <typename t_int>
+		void decode_gt(char const *data, std::size_t const ploidy, std::size_t const sample_count);
+
+	public:
+		bcf_reader():
+			m_buffer(1024 * 1024)
+		{
+		}
+
+		// Takes ownership of the file descriptor.
+		void open(int const fd) { m_reader.open(fd); }
+
+		void read_header() override;
+		void fill_buffer() override;
+		void reset() override;
+
+		// Start each pass from the given record, e.g. one found with a CSI index.
+		void set_first_variant_offset(bgzf_reader::virtual_offset_type const offset) { m_first_variant_offset = offset; }
+
+		// Find the index of the given sequence in the header. Return false if not found.
+		bool contig_index(std::string const &name, std::size_t &idx) const;
+	};
+}
+
+#endif
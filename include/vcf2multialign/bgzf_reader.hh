@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_BGZF_READER_HH
+#define VCF2MULTIALIGN_BGZF_READER_HH
+
+#include <cstdint>
+#include <string>
+#include <vcf2multialign/dispatch_fn.hh>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	enum class compression_type : uint8_t {
+		NONE	= 0,
+		GZIP,		// Gzip but not BGZF.
+		BGZF
+	};
+
+
+	// Check the first bytes of the given file. Does not change the file offset.
+	compression_type detect_compression(int const fd);
+
+
+	// Read a BGZF file decompressing the blocks in parallel.
+	// Offsets are virtual file offsets as specified in SAMv1, i.e. the compressed
+	// offset of the block is stored in the upper 48 bits and the offset within
+	// the decompressed block in the lower 16 bits.
+	class bgzf_reader
+	{
+	public:
+		typedef std::uint64_t virtual_offset_type;
+
+	protected:
+		struct block
+		{
+			std::vector <char>	data;					// Decompressed.
+			std::uint64_t		coffset{0};				// Compressed offset of the block in the file.
+			std::size_t			batch_offset{0};		// Offset of the block in batch::compressed.
+			std::size_t			compressed_size{0};
+		};
+
+		struct batch
+		{
+			std::vector <char>	compressed;
+			std::vector <block>	blocks;
+			std::size_t			block_count{0};			// Blocks are reused, so use a separate count.
+			std::uint64_t		coffset{0};				// Offset of compressed[0].
+			std::uint64_t		next_coffset{0};		// Offset of the first block not in this batch.
+			bool				is_last{false};
+
+			void clear() { block_count = 0; is_last = false; }
+		};
+
+	protected:
+		dispatch_ptr <dispatch_group_t>	m_prefetch_group{};
+		batch							m_current;
+		batch							m_next;
+		std::size_t						m_batch_size{0};
+		std::size_t						m_block_idx{0};
+		std::size_t						m_block_pos{0};
+		int								m_fd{-1};
+		bool							m_is_prefetching{false};
+
+	protected:
+		static void prefetch(void *ctx);
+		static void decompress_block(void *ctx, std::size_t const idx);
+
+		void load_batch(batch &dst, std::uint64_t const coffset) const;
+		void start_prefetch();
+		void wait_for_prefetch();
+		bool ensure_data();
+
+	public:
+		// batch_size is the amount of compressed data to be read and decompressed at a time.
+		bgzf_reader(std::size_t const batch_size = 4 * 1024 * 1024);
+		~bgzf_reader();
+
+		bgzf_reader(bgzf_reader const &) = delete;
+		bgzf_reader &operator=(bgzf_reader const &) = delete;
+
+		// Takes ownership of the file descriptor.
+		void open(int const fd);
+
+		// Read at most len characters. Set at_eof if the end of the file was reached.
+		std::size_t read(char *dst, std::size_t const len, bool &at_eof);
+		bool getline(std::string &dst);
+
+		virtual_offset_type tell() const;
+		void seek(virtual_offset_type const offset);
+	};
+}
+
+#endif
@@ -16,6 +16,7 @@ namespace vcf2multialign {
 		vcf_reader &reader,
 		sv_handling const sv_handling_method,
 		variant_set /* out */ &skipped_variants,
+		valid_alt_map /* out */ &valid_alts,
 		error_logger &error_logger
 	);
 }
@@ -26,7 +26,7 @@ namespace vcf2multialign {
 		
 		void log_skipped_structural_variant(std::size_t const line, std::size_t const alt_idx, sv_type const svt);
 		
-		void log_invalid_alt_seq(std::size_t const line, std::size_t const alt_idx, std::string const &alt);
+		void log_invalid_alt_seq(std::size_t const line, std::size_t const alt_idx, std::string_view const &alt);
 		
 		void log_conflicting_variants(std::size_t const line_1, std::size_t const line_2);
 		
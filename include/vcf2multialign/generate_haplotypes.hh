@@ -5,22 +5,40 @@
 
 #include <cstddef>
 #include <vcf2multialign/types.hh>
+#include <vector>
 
 
 namespace vcf2multialign {
-
+	
+	// A variant file and the corresponding reference, processed in a separate pipeline.
+	// Multiple variant files are read in lock-step as partitions of the samples of one file.
+	struct input_files
+	{
+		char const					*reference_fname{nullptr};
+		std::vector <char const *>	variants_fnames;
+	};
+	
+	
 	void generate_haplotypes(
-		char const *reference_fname,
-		char const *variants_fname,
+		std::vector <input_files> const &input_files,
 		char const *out_reference_fname,
 		char const *report_fname,
 		char const *null_allele_seq,
+		char const *region,
 		std::size_t const chunk_size,
+		std::size_t const parser_thread_count,
+		std::size_t const split_line_length,
+		std::size_t const max_pipeline_count,
+		std::size_t const max_memory,
+		std::size_t const input_buffer_size,
+		std::size_t const read_ahead_buffer_count,
+		std::size_t const sort_buffer_size,
 		std::size_t const variant_padding,
 		sv_handling const sv_handling_method,
 		bool const should_overwrite_files,
 		bool const should_check_ref,
 		bool const should_reduce_samples,
-		bool const allow_switch_to_ref
+		bool const allow_switch_to_ref,
+		bool const should_use_line_index
 	 );
 }
@@ -11,8 +11,8 @@
 #include <boost/container/vector.hpp>
 #include <map>
 #include <utility>
+#include <vcf2multialign/util.hh>
 #include <vcf2multialign/variant.hh>
-#include <vcf2multialign/variant_processor_delegate.hh>
 #include <vcf2multialign/vcf_reader.hh>
 #include <vector>
 
@@ -111,20 +111,14 @@ namespace vcf2multialign {
 	typedef std::vector <std::map <std::size_t, variant_sequence>> range_map;
 	
 	
-	struct sample_reducer_delegate : public virtual variant_processor_delegate
-	{
-		virtual vcf_reader::sample_name_map const &sample_names() const = 0;
-	};
-	
-	
-	class sample_reducer
+	// Handles the parts of reducing the samples that do not depend on the delegate.
+	class sample_reducer_base
 	{
 	protected:
 		typedef std::map <std::size_t, boost::container::list <variant_sequence>> subsequence_map;
 
 	protected:
 		range_map											*m_compressed_ranges{};
-		sample_reducer_delegate								*m_delegate{};
 		std::map <variant_sequence_id, variant_sequence>	m_variant_sequences;	// Variant sequences by sample number.
 		subsequence_map										m_prepared_sequences;
 		std::size_t											m_padding_amt{};
@@ -133,7 +127,7 @@ namespace vcf2multialign {
 		bool												m_allow_switch_to_ref{false};
 		
 	public:
-		sample_reducer(
+		sample_reducer_base(
 			range_map			&compressed_ranges,
 			std::size_t const	padding_amt,
 			bool const			output_ref,
@@ -146,11 +140,9 @@ namespace vcf2multialign {
 		{
 		}
 		
-		void set_delegate(sample_reducer_delegate &delegate) { m_delegate = &delegate; }
 		range_map &compressed_ranges() { return *m_compressed_ranges; }
 		
 		void prepare();
-		void handle_variant(variant &var);
 		void finish();
 		
 	protected:
@@ -164,6 +156,70 @@ namespace vcf2multialign {
 		void assign_ranges_greedy();
 		void print_prepared_sequences();
 	};
+	
+	
+	// t_delegate needs to provide is_valid_alt(alt_idx), enumerate_carriers(var, cb),
+	// assigned_alt_to_sequence(alt_idx), found_overlapping_alt(lineno, alt_idx, sample_no, chr_idx)
+	// and handled_alt(alt_idx) like the one of sequence_writer.
+	template <typename t_delegate>
+	class sample_reducer : public sample_reducer_base
+	{
+	protected:
+		t_delegate											*m_delegate{};
+		
+	public:
+		using sample_reducer_base::sample_reducer_base;
+		
+		void set_delegate(t_delegate &delegate) { m_delegate = &delegate; }
+		void handle_variant(variant &var);
+	};
+	
+	
+	// Create subsequences.
+	template <typename t_delegate>
+	void sample_reducer <t_delegate>::handle_variant(variant &var)
+	{
+		// Verify that the positions are in increasing order.
+		auto const lineno(var.lineno());
+		auto const pos(var.zero_based_pos());
+		
+		always_assert(m_last_position <= pos, "Positions not in increasing order");
+		
+		// Only the non-reference alleles affect the sequences.
+		m_delegate->enumerate_carriers(var,
+			[
+				this,
+				lineno,
+				pos
+			](
+				std::size_t const sample_no, uint8_t const chr_idx, std::size_t const alt_idx
+			) {
+				if (m_delegate->is_valid_alt(alt_idx))
+				{
+					// Add the ALT index to the corresponding sequence.
+					variant_sequence_id seq_id(sample_no, chr_idx);
+					variant_sequence &seq(m_variant_sequences[seq_id]);
+					
+					// First check if the previous variant is beyond the padding distance.
+					if (check_variant_sequence(seq, seq_id, pos))
+					{
+						seq.add_alt(lineno, pos, alt_idx);
+						m_delegate->assigned_alt_to_sequence(alt_idx);
+					}
+					else
+					{
+						auto const sample_no(seq.sample_no());
+						auto const chr_idx(seq.chr_idx());
+						m_delegate->found_overlapping_alt(lineno, alt_idx, sample_no, chr_idx);
+					}
+					
+					m_delegate->handled_alt(alt_idx);
+				}
+			}
+		);
+		
+		m_last_position = pos;
+	}
 }
 
 #endif
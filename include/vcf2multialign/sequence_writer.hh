@@ -6,21 +6,16 @@
 #ifndef VCF2MULTIALIGN_SEQUENCE_WRITER_HH
 #define VCF2MULTIALIGN_SEQUENCE_WRITER_HH
 
+#include <cstdint>
 #include <map>
 #include <stack>
 #include <vcf2multialign/types.hh>
 #include <vcf2multialign/util.hh>
-#include <vcf2multialign/variant_processor_delegate.hh>
+#include <vcf2multialign/variant.hh>
 
 
 namespace vcf2multialign {
 
-	struct sequence_writer_delegate : public virtual variant_processor_delegate
-	{
-		virtual std::set <std::size_t> const &valid_alts(variant &var) const = 0;
-	};
-	
-	
 	struct skipped_sample
 	{
 		std::size_t	sample_no{0};
@@ -81,15 +76,14 @@ namespace vcf2multialign {
 	};
 	
 	
-	class sequence_writer
+	// Handles the parts of writing the sequences that do not depend on the delegate.
+	class sequence_writer_base
 	{
 	protected:
 		typedef std::stack <variant_overlap>			overlap_stack_type;
 		typedef std::vector <size_t>					sample_number_vector;
 		
 	protected:
-		sequence_writer_delegate						*m_delegate{};
-		
 		vector_type	const								*m_reference{};
 
 		overlap_stack_type								m_overlap_stack;
@@ -101,8 +95,11 @@ namespace vcf2multialign {
 
 		std::string const								*m_null_allele_seq{};
 		
+		std::size_t										m_output_start{0};
+		std::size_t										m_output_end{SIZE_MAX};
+		
 	public:
-		sequence_writer(
+		sequence_writer_base(
 			vector_type const &reference,
 			std::string const &null_allele
 		):
@@ -111,17 +108,94 @@ namespace vcf2multialign {
 		{
 		}
 		
-		void set_delegate(sequence_writer_delegate &delegate) { m_delegate = &delegate; }
+		// Output only the part [start, end) (zero-based) of the reference and the variants therein.
+		void set_output_range(std::size_t const start, std::size_t const end) { m_output_start = start; m_output_end = end; }
 		
 		void prepare(haplotype_map &haplotypes);
-		void handle_variant(variant &var);
 		void finish();
 		
 	protected:
+		haplotype_ptr_map &alt_haplotypes(std::string_view const &alt);
+		std::string_view alt_string(variant const &var, std::size_t const alt_idx) const;
 		void fill_streams(haplotype_ptr_map &haplotypes, size_t const fill_amt) const;
 		void output_reference(std::size_t const output_start_pos, std::size_t const output_end_pos);
 		std::size_t process_overlap_stack(size_t const var_pos);
+		variant_overlap &output_up_to_variant(variant const &var);
+		void push_variant_overlap(variant const &var, variant_overlap &previous_variant);
+		void assign_alt_to_haplotype(
+			std::string_view const &alt,
+			std::size_t const sample_no,
+			uint8_t const chr_idx,
+			std::vector <haplotype *> &ref_ptrs
+		);
+	};
+	
+	
+	// The delegate type is a template parameter so that the calls made for each haplotype may be inlined.
+	// t_delegate needs to provide is_valid_alt(alt_idx), valid_alts(var), enumerate_carriers(var, cb)
+	// that calls cb(sample_no, chr_idx, alt_idx), assigned_alt_to_sequence(alt_idx),
+	// found_overlapping_alt(lineno, alt_idx, sample_no, chr_idx), handled_alt(alt_idx) and handled_haplotypes(var).
+	template <typename t_delegate>
+	class sequence_writer : public sequence_writer_base
+	{
+	protected:
+		t_delegate										*m_delegate{};
+		
+	public:
+		using sequence_writer_base::sequence_writer_base;
+		
+		void set_delegate(t_delegate &delegate) { m_delegate = &delegate; }
+		void handle_variant(variant &var);
 	};
+	
+	
+	template <typename t_delegate>
+	void sequence_writer <t_delegate>::handle_variant(variant &var)
+	{
+		auto &previous_variant(output_up_to_variant(var));
+		
+		// Find haplotypes that have the variant.
+		// First make sure that all valid alts are listed in m_alt_haplotypes.
+		for (auto const alt_idx : m_delegate->valid_alts(var))
+			alt_haplotypes(alt_string(var, alt_idx));
+		m_alt_haplotypes[*m_null_allele_seq];
+		
+		// Only the haplotypes that have a non-reference allele need to be moved.
+		auto const lineno(var.lineno());
+		m_delegate->enumerate_carriers(var,
+			[
+				this,
+				lineno,
+				&var
+			](
+				std::size_t const sample_no, uint8_t const chr_idx, std::size_t const alt_idx
+			) {
+				if (m_delegate->is_valid_alt(alt_idx))
+				{
+					// Skip the samples not handled in the current round.
+					auto const ref_it(m_ref_haplotype_ptrs.find(sample_no));
+					if (m_ref_haplotype_ptrs.end() == ref_it)
+						return;
+					
+					auto &ref_ptrs(ref_it->second);
+					if (ref_ptrs[chr_idx])
+					{
+						assign_alt_to_haplotype(alt_string(var, alt_idx), sample_no, chr_idx, ref_ptrs);
+						m_delegate->assigned_alt_to_sequence(alt_idx);
+					}
+					else
+					{
+						m_delegate->found_overlapping_alt(lineno, alt_idx, sample_no, chr_idx);
+					}
+					
+					m_delegate->handled_alt(alt_idx);
+				}
+			}
+		);
+		
+		m_delegate->handled_haplotypes(var);
+		push_variant_overlap(var, previous_variant);
+	}
 }
 
 #endif
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_SPSC_RING_HH
+#define VCF2MULTIALIGN_SPSC_RING_HH
+
+#include <atomic>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	// Bounded queue for one producer thread and one consumer thread.
+	// push() may only be called by the producer and pop() by the consumer.
+	template <typename t_value>
+	class spsc_ring
+	{
+	protected:
+		std::vector <t_value>	m_values;
+		std::atomic_size_t		m_head{0};		// Next value to be popped, modified by the consumer.
+		std::atomic_size_t		m_tail{0};		// Next free slot, modified by the producer.
+
+	public:
+		explicit spsc_ring(std::size_t const capacity):
+			m_values(capacity)
+		{
+		}
+
+		spsc_ring(spsc_ring const &) = delete;
+		spsc_ring &operator=(spsc_ring const &) = delete;
+
+		std::size_t capacity() const { return m_values.size(); }
+		std::size_t size() const { return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire); }
+		bool empty() const { return 0 == size(); }
+
+		// Return false if the ring is full.
+		bool push(t_value &&value)
+		{
+			auto const tail(m_tail.load(std::memory_order_relaxed));
+			if (tail - m_head.load(std::memory_order_acquire) == m_values.size())
+				return false;
+
+			m_values[tail % m_values.size()] = std::move(value);
+			m_tail.store(1 + tail, std::memory_order_release);
+			return true;
+		}
+
+		// Return false if the ring is empty.
+		bool pop(t_value &dst)
+		{
+			auto const head(m_head.load(std::memory_order_relaxed));
+			if (head == m_tail.load(std::memory_order_acquire))
+				return false;
+
+			dst = std::move(m_values[head % m_values.size()]);
+			m_head.store(1 + head, std::memory_order_release);
+			return true;
+		}
+	};
+}
+
+#endif
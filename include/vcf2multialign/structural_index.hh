@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_STRUCTURAL_INDEX_HH
+#define VCF2MULTIALIGN_STRUCTURAL_INDEX_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(__BMI2__)
+#	include <immintrin.h>
+#endif
+
+
+namespace vcf2multialign {
+
+	// Bit masks of the characters that delimit the fields in a block of 64 characters.
+	// Bit i corresponds to the i-th character of the block.
+	struct structural_masks
+	{
+		std::uint64_t	tab{0};
+		std::uint64_t	newline{0};
+		std::uint64_t	colon{0};
+		std::uint64_t	gt_separator{0};	// '|' or '/'.
+	};
+
+
+	// Fill the masks from the 64 characters that start from data.
+	inline void find_structural_characters(char const *data, structural_masks &masks)
+	{
+#if defined(__AVX2__)
+		__m256i const tab(_mm256_set1_epi8('\t'));
+		__m256i const newline(_mm256_set1_epi8('\n'));
+		__m256i const colon(_mm256_set1_epi8(':'));
+		__m256i const pipe(_mm256_set1_epi8('|'));
+		__m256i const slash(_mm256_set1_epi8('/'));
+
+		masks = structural_masks();
+		for (std::size_t i(0); i < 2; ++i)
+		{
+			auto const shift(32 * i);
+			__m256i const v(_mm256_loadu_si256(reinterpret_cast <__m256i const *>(data + shift)));
+			auto const gt_sep(_mm256_or_si256(_mm256_cmpeq_epi8(v, pipe), _mm256_cmpeq_epi8(v, slash)));
+			masks.tab			|= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, tab)))) << shift;
+			masks.newline		|= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)))) << shift;
+			masks.colon			|= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, colon)))) << shift;
+			masks.gt_separator	|= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(gt_sep))) << shift;
+		}
+#elif defined(__SSE2__)
+		__m128i const tab(_mm_set1_epi8('\t'));
+		__m128i const newline(_mm_set1_epi8('\n'));
+		__m128i const colon(_mm_set1_epi8(':'));
+		__m128i const pipe(_mm_set1_epi8('|'));
+		__m128i const slash(_mm_set1_epi8('/'));
+
+		masks = structural_masks();
+		for (std::size_t i(0); i < 4; ++i)
+		{
+			auto const shift(16 * i);
+			__m128i const v(_mm_loadu_si128(reinterpret_cast <__m128i const *>(data + shift)));
+			auto const gt_sep(_mm_or_si128(_mm_cmpeq_epi8(v, pipe), _mm_cmpeq_epi8(v, slash)));
+			masks.tab			|= std::uint64_t(std::uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, tab)))) << shift;
+			masks.newline		|= std::uint64_t(std::uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)))) << shift;
+			masks.colon			|= std::uint64_t(std::uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, colon)))) << shift;
+			masks.gt_separator	|= std::uint64_t(std::uint16_t(_mm_movemask_epi8(gt_sep))) << shift;
+		}
+#else
+		masks = structural_masks();
+		for (std::size_t i(0); i < 64; ++i)
+		{
+			std::uint64_t const bit(std::uint64_t(1) << i);
+			switch (data[i])
+			{
+				case '\t':
+					masks.tab |= bit;
+					break;
+
+				case '\n':
+					masks.newline |= bit;
+					break;
+
+				case ':':
+					masks.colon |= bit;
+					break;
+
+				case '|':
+				case '/':
+					masks.gt_separator |= bit;
+					break;
+
+				default:
+					break;
+			}
+		}
+#endif
+	}
+
+
+	// Return the index of the n-th (zero-based) set bit of mask, which should have more than n bits set.
+	inline std::size_t select_bit(std::uint64_t mask, std::size_t n)
+	{
+#if defined(__BMI2__)
+		return __builtin_ctzll(_pdep_u64(std::uint64_t(1) << n, mask));
+#else
+		while (n--)
+			mask &= mask - 1;
+		return __builtin_ctzll(mask);
+#endif
+	}
+
+
+	// Locate field separators in a range of characters 64 characters at a time
+	// instead of comparing the characters one by one. The masks of the current
+	// block are cached.
+	class structural_index
+	{
+	public:
+		enum { BLOCK_SIZE = 64 };
+
+	protected:
+		structural_masks	m_masks;
+		char const			*m_begin{nullptr};
+		char const			*m_end{nullptr};
+		char const			*m_block{nullptr};	// Start of the cached block.
+
+	protected:
+		char const *block_start(char const *p) const { return m_begin + ((p - m_begin) & ~std::ptrdiff_t(BLOCK_SIZE - 1)); }
+		inline void load_block(char const *block);
+
+	public:
+		structural_index() = default;
+
+		structural_index(char const *begin, char const *end):
+			m_begin(begin),
+			m_end(end)
+		{
+		}
+
+		void set_range(char const *begin, char const *end) { m_begin = begin; m_end = end; m_block = nullptr; }
+
+		// Return a pointer to the first newline in [p, end) or nullptr if there is none.
+		inline char const *find_newline(char const *p);
+
+		// Return a pointer to the first tab, newline or colon in [p, end) or nullptr if there is none.
+		inline char const *find_subfield_separator(char const *p);
+
+		// Return a pointer to the count-th (one-based) tab or newline in [p, end).
+		// Stop at the first newline even if fewer separators were found.
+		// Return nullptr if there is neither.
+		inline char const *find_separator(char const *p, std::size_t count);
+
+		// Return a pointer to the last newline in [begin, end) or nullptr if there is none.
+		inline char const *find_last_newline();
+
+		// Return the number of newlines in [begin, end).
+		inline std::size_t count_newlines();
+		
+		// Return the number of tabs in [begin, end).
+		inline std::size_t count_tabs();
+	};
+
+
+	void structural_index::load_block(char const *block)
+	{
+		if (block == m_block)
+			return;
+
+		m_block = block;
+		if (BLOCK_SIZE <= m_end - block)
+			find_structural_characters(block, m_masks);
+		else
+		{
+			// Pad the last block.
+			char buffer[BLOCK_SIZE]{};
+			std::memcpy(buffer, block, m_end - block);
+			find_structural_characters(buffer, m_masks);
+		}
+	}
+
+
+	char const *structural_index::find_newline(char const *p)
+	{
+		char const *block(block_start(p));
+		std::uint64_t valid(~std::uint64_t(0) << (p - block));
+		while (block < m_end)
+		{
+			load_block(block);
+			auto const newlines(m_masks.newline & valid);
+			if (newlines)
+				return block + __builtin_ctzll(newlines);
+
+			block += BLOCK_SIZE;
+			valid = ~std::uint64_t(0);
+		}
+
+		return nullptr;
+	}
+
+
+	char const *structural_index::find_subfield_separator(char const *p)
+	{
+		char const *block(block_start(p));
+		std::uint64_t valid(~std::uint64_t(0) << (p - block));
+		while (block < m_end)
+		{
+			load_block(block);
+			auto const separators((m_masks.tab | m_masks.newline | m_masks.colon) & valid);
+			if (separators)
+				return block + __builtin_ctzll(separators);
+
+			block += BLOCK_SIZE;
+			valid = ~std::uint64_t(0);
+		}
+
+		return nullptr;
+	}
+
+
+	char const *structural_index::find_separator(char const *p, std::size_t count)
+	{
+		char const *block(block_start(p));
+		std::uint64_t valid(~std::uint64_t(0) << (p - block));
+		while (block < m_end)
+		{
+			load_block(block);
+			auto const newlines(m_masks.newline & valid);
+			auto separators((m_masks.tab | m_masks.newline) & valid);
+
+			// Ignore the separators after the first newline.
+			if (newlines)
+				separators &= newlines ^ (newlines - 1);
+
+			std::size_t const separator_count(__builtin_popcountll(separators));
+			if (count <= separator_count)
+				return block + select_bit(separators, count - 1);
+
+			if (newlines)
+				return block + __builtin_ctzll(newlines);
+
+			count -= separator_count;
+			block += BLOCK_SIZE;
+			valid = ~std::uint64_t(0);
+		}
+
+		return nullptr;
+	}
+
+
+	char const *structural_index::find_last_newline()
+	{
+		if (m_begin == m_end)
+			return nullptr;
+
+		char const *block(block_start(m_end - 1));
+		while (true)
+		{
+			load_block(block);
+			if (m_masks.newline)
+				return block + 63 - __builtin_clzll(m_masks.newline);
+
+			if (block == m_begin)
+				return nullptr;
+
+			block -= BLOCK_SIZE;
+		}
+	}
+
+
+	std::size_t structural_index::count_newlines()
+	{
+		std::size_t retval(0);
+		for (char const *block(m_begin); block < m_end; block += BLOCK_SIZE)
+		{
+			load_block(block);
+			retval += __builtin_popcountll(m_masks.newline);
+		}
+		return retval;
+	}
+
+
+	std::size_t structural_index::count_tabs()
+	{
+		std::size_t retval(0);
+		for (char const *block(m_begin); block < m_end; block += BLOCK_SIZE)
+		{
+			load_block(block);
+			retval += __builtin_popcountll(m_masks.tab);
+		}
+		return retval;
+	}
+}
+
+#endif
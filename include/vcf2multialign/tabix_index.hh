@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_TABIX_INDEX_HH
+#define VCF2MULTIALIGN_TABIX_INDEX_HH
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vcf2multialign/bgzf_reader.hh>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	// Reader for tabix (.tbi) and coordinate-sorted (.csi) indices.
+	class tabix_index
+	{
+	public:
+		typedef bgzf_reader::virtual_offset_type	virtual_offset_type;
+
+	protected:
+		struct chunk
+		{
+			virtual_offset_type	beg{0};
+			virtual_offset_type	end{0};
+		};
+
+		struct bin
+		{
+			std::vector <chunk>	chunks;
+			virtual_offset_type	loffset{0};		// CSI only.
+		};
+
+		struct reference
+		{
+			std::map <std::uint32_t, bin>		bins;
+			std::vector <virtual_offset_type>	linear_index;	// TBI only.
+		};
+
+	protected:
+		std::map <std::string, std::size_t>	m_reference_ids;
+		std::vector <reference>				m_references;
+		std::int32_t						m_min_shift{14};
+		std::int32_t						m_depth{5};
+		bool								m_is_csi{false};
+
+	protected:
+		void read_sequence_names(char const *data, std::size_t const len);
+		void list_bins(std::uint64_t const beg, std::uint64_t end, std::vector <std::uint32_t> &bins) const;
+		virtual_offset_type min_offset(reference const &ref, std::uint64_t const beg) const;
+
+	public:
+		// Return false if the file could not be opened.
+		bool open(char const *fname);
+
+		// Find the virtual offset of the first record that may overlap [beg, end) (zero-based).
+		// Return false if the index has no records for the given sequence and range.
+		bool find_first_offset(
+			std::string const &seq_name,
+			std::uint64_t const beg,
+			std::uint64_t const end,
+			virtual_offset_type &offset
+		) const;
+
+		// Same as above but with the index of the sequence, e.g. in the BCF header.
+		bool find_first_offset(
+			std::size_t const seq_idx,
+			std::uint64_t const beg,
+			std::uint64_t const end,
+			virtual_offset_type &offset
+		) const;
+	};
+}
+
+#endif
@@ -10,6 +10,9 @@
 #include <boost/iostreams/stream.hpp>
 #include <map>
 #include <set>
+#include <string>
+#include <string_view>
+#include <vcf2multialign/variant_filters.hh>
 #include <vector>
 
 
@@ -20,7 +23,6 @@ namespace vcf2multialign {
 	typedef boost::iostreams::stream <boost::iostreams::file_descriptor_sink>	file_ostream;
 	
 	typedef std::vector <char> vector_type;
-	typedef std::set <std::size_t> variant_set;
 	
 	struct sample_count
 	{
@@ -48,7 +50,8 @@ namespace vcf2multialign {
 	
 	typedef std::map <
 		std::string,				// ALT
-		haplotype_ptr_map
+		haplotype_ptr_map,
+		std::less <>				// Allow finding by std::string_view.
 	> alt_map;
 	
 	
@@ -72,7 +75,8 @@ namespace vcf2multialign {
 		GQ,
 		PS,
 		PQ,
-		MQ
+		MQ,
+		OTHER
 	};
 	
 	enum { NULL_ALLELE = std::numeric_limits <uint8_t>::max() };
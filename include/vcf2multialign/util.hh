@@ -6,7 +6,11 @@
 #ifndef VCF2MULTIALIGN_UTIL_HH
 #define VCF2MULTIALIGN_UTIL_HH
 
+#include <cerrno>
+#include <cstdlib>
 #include <iostream>
+#include <string>
+#include <unistd.h>
 
 
 namespace vcf2multialign {
@@ -37,6 +41,39 @@ namespace vcf2multialign {
 			abort();
 		}
 	}
+	
+	
+	// Create an unlinked temporary file in $TMPDIR. Return -1 and leave errno set on failure.
+	inline int open_temporary_file()
+	{
+		char const *tmpdir(getenv("TMPDIR"));
+		std::string path(tmpdir && *tmpdir ? tmpdir : "/tmp");
+		path += "/vcf2multialign.XXXXXX";
+		
+		int const fd(mkstemp(path.data()));
+		if (-1 != fd)
+			unlink(path.c_str());
+		return fd;
+	}
+	
+	
+	// Write the whole buffer. Return false and leave errno set on failure.
+	inline bool write_all(int const fd, char const *data, std::size_t const len)
+	{
+		std::size_t written(0);
+		while (written < len)
+		{
+			auto const res(write(fd, data + written, len - written));
+			if (-1 == res)
+			{
+				if (EINTR == errno)
+					continue;
+				return false;
+			}
+			written += res;
+		}
+		return true;
+	}
 }
 
 #endif
@@ -6,9 +6,14 @@
 #ifndef VCF2MULTIALIGN_VARIANT_HH
 #define VCF2MULTIALIGN_VARIANT_HH
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
 #include <experimental/string_view>
+#include <limits>
 #include <vcf2multialign/types.hh>
 #include <vcf2multialign/util.hh>
+#include <vcf2multialign/variant_slab.hh>
 #include <vector>
 
 
@@ -49,28 +54,42 @@ namespace vcf2multialign {
 	class variant_base;
 	
 	
-	struct genotype_field
+	// ALT index of one chromosome copy of a sample, NULL_ALLELE for “.”.
+	typedef uint16_t genotype_code;
+	enum { ABSENT_GENOTYPE_CODE = std::numeric_limits <genotype_code>::max() };	// Past the ploidy of the sample.
+	
+	
+	// A non-reference allele of a sample, i.e. one with a non-zero ALT index.
+	struct genotype_carrier
 	{
+		std::size_t	sample_no{0};
 		std::size_t	alt{0};
-		bool		is_phased{false};
+		uint8_t		chr_idx{0};
 	};
 	
 	
+	// The genotype values of one sample in the genotype block of a variant.
 	class sample_field
 	{
 		friend class variant_base;
 		
-	public:
-		typedef std::vector <genotype_field> genotype_vector;
-		
 	protected:
-		genotype_vector	m_genotype;
-		std::size_t		m_gt_count{0};
+		genotype_code const	*m_codes{nullptr};
+		uint64_t const		*m_phase_mask{nullptr};
+		std::size_t			m_first_slot{0};
+		std::size_t			m_ploidy{0};
 		
 	public:
+		std::size_t ploidy() const { return m_ploidy; }
+		std::size_t alt(std::size_t const idx) const { assert(idx < m_ploidy); return m_codes[m_first_slot + idx]; }
 		
-		std::size_t ploidy() const { return m_gt_count; }
-		boost::iterator_range <genotype_vector::const_iterator> get_genotype() const;
+		// True if the separator before the given value was “|”.
+		bool is_phased(std::size_t const idx) const
+		{
+			assert(idx < m_ploidy);
+			auto const slot(m_first_slot + idx);
+			return (m_phase_mask[slot / 64] >> (slot % 64)) & 0x1;
+		}
 	};
 	
 	
@@ -79,17 +98,31 @@ namespace vcf2multialign {
 		friend class vcf_reader;
 		
 	protected:
-		std::vector <sample_field>	m_samples;
-		std::vector <sv_type>		m_alt_sv_types;
-		std::size_t					m_sample_count{0};
-		std::size_t					m_pos{0};
-		std::size_t					m_qual{0};
-		std::size_t					m_lineno{0};
+		// The genotypes are stored in one block with m_ploidy_stride slots per sample
+		// so that copying a variant does not need an allocation for each sample.
+		std::vector <genotype_code>		m_gt_codes;			// ABSENT_GENOTYPE_CODE in the slots past the ploidy of each sample.
+		std::vector <uint64_t>			m_phase_mask;		// One bit per slot, set if the preceding separator was “|”.
+		std::vector <uint8_t>			m_ploidies;
+		std::vector <genotype_carrier>	m_carriers;			// Non-reference alleles in sample order.
+		std::vector <sv_type>			m_alt_sv_types;
+		std::size_t						m_ploidy_stride{2};
+		std::size_t						m_sample_count{0};
+		std::size_t						m_pos{0};
+		std::size_t						m_qual{0};
+		std::size_t						m_lineno{0};
+		bool							m_is_phased{true};	// All the parsed genotypes are phased.
+		
+	protected:
+		void reserve_samples(std::size_t const count);
+		void set_ploidy_stride(std::size_t const stride);
+		inline void clear_sample(std::size_t const sample_no);
+		inline void set_phase_bit(std::size_t const slot, bool const is_phased);
+		inline void set_genotype_code(std::size_t const alt, std::size_t const sample_no, std::size_t const idx);
 		
 	public:
-		variant_base(std::size_t sample_count):
-			m_samples(1 + sample_count)
+		variant_base(std::size_t sample_count)
 		{
+			reserve_samples(1 + sample_count);
 		}
 		
 		variant_base(variant_base const &) = default;
@@ -103,14 +136,39 @@ namespace vcf2multialign {
 		void set_pos(std::size_t const pos) { m_pos = pos; }
 		void set_qual(std::size_t const qual) { m_qual = qual; }
 		void set_gt(std::size_t const alt, std::size_t const sample, std::size_t const idx, bool const is_phased);
+		inline void set_diploid_gt(std::size_t const alt_1, std::size_t const alt_2, std::size_t const sample, bool const is_phased);
 		void set_alt_sv_type(sv_type const svt, std::size_t const pos);
-		void reset() { m_sample_count = 0; m_alt_sv_types.clear(); }	// Try to prevent unneeded deallocation of samples.
+		
+		// Bulk alternative to set_gt for filling disjoint ranges of samples in parallel.
+		// After calling prepare_samples, set_gt_in_range and clear_gt_in_range may be called
+		// concurrently for distinct samples. idx needs to be less than ploidy_stride().
+		// The carriers are added in sample order with add_carriers.
+		void prepare_samples(std::size_t const last_sample_no, std::size_t const min_ploidy_stride = 0);
+		inline void set_gt_in_range(std::size_t const alt, std::size_t const sample_no, std::size_t const idx, bool const is_phased);
+		void clear_gt_in_range(std::size_t const sample_no) { clear_sample(sample_no); }
+		void add_carriers(std::vector <genotype_carrier> const &carriers, bool const is_phased);
+		void clear_samples() { m_sample_count = 0; m_carriers.clear(); m_is_phased = true; }
+		
+		// Copy the genotypes of other’s samples to the samples starting from sample_offset + 1, after calling prepare_samples.
+		void copy_genotypes(variant_base const &other, std::size_t const sample_offset);
+		
+		void reset() { m_sample_count = 0; m_carriers.clear(); m_alt_sv_types.clear(); m_is_phased = true; }	// Try to prevent unneeded deallocation of samples.
 
 		size_t lineno() const											{ return m_lineno; }
 		size_t pos() const												{ return m_pos; };
+		size_t qual() const												{ return m_qual; }
+		size_t sample_count() const										{ return m_sample_count; }	// One more than the last parsed sample number.
 		size_t zero_based_pos() const;
 		std::vector <sv_type> const &alt_sv_types() const				{ return m_alt_sv_types; }
-		sample_field const &sample(std::size_t const sample_idx) const	{ always_assert(sample_idx <= m_sample_count); return m_samples.at(sample_idx); }
+		std::vector <genotype_carrier> const &carriers() const			{ return m_carriers; }
+		bool is_phased() const											{ return m_is_phased; }
+		inline sample_field sample(std::size_t const sample_no) const;
+		
+		// Bulk access to the genotype block. The values of sample i are in slots
+		// [i * ploidy_stride(), (i + 1) * ploidy_stride()) for i < sample_count().
+		std::size_t ploidy_stride() const								{ return m_ploidy_stride; }
+		genotype_code const *genotype_codes() const						{ return m_gt_codes.data(); }
+		std::vector <uint64_t> const &phase_mask() const				{ return m_phase_mask; }
 	};
 	
 	
@@ -157,6 +215,8 @@ namespace vcf2multialign {
 		variant_tpl &operator=(variant_tpl <t_other_string> const &other);
 		
 		std::vector <t_string> const &alts() const	{ return m_alts; }
+		std::vector <t_string> const &ids() const	{ return m_id; }
+		t_string const &chrom_id() const			{ return m_chrom_id; }
 		t_string const &ref() const					{ return m_ref; }
 		
 		void reset() { variant_base::reset(); m_alts.clear(); m_id.clear(); };
@@ -182,25 +242,134 @@ namespace vcf2multialign {
 	};
 	
 	
-	class variant : public variant_tpl <std::string>
+	// Strings point to a slab that is kept alive by the variant, cf. variant_buffer.
+	class variant : public variant_tpl <std::string_view>
 	{
 		friend class vcf_reader;
 
 	protected:
 		typedef variant_tpl superclass;
+		
+	protected:
+		variant_slab_ptr	m_slab;
+
+	public:
+		using variant_tpl::variant_tpl;
+		void reset();
+		
+		// Copy the strings of other to the slab, which needs to have string_length(other) characters available.
+		void assign(transient_variant const &other, variant_slab_ptr const &slab);
+		static std::size_t string_length(transient_variant const &var);
+	};
+	
+	
+	// Owns its strings.
+	class persistent_variant : public variant_tpl <std::string>
+	{
+	protected:
+		typedef variant_tpl superclass;
 
 	public:
 		using variant_tpl::variant_tpl;
 		void reset();
 		
-		variant &operator=(transient_variant const &other) { variant_tpl::operator=(other); return *this; }
+		persistent_variant &operator=(transient_variant const &other) { variant_tpl::operator=(other); return *this; }
 	};
 	
 	
-	inline auto sample_field::get_genotype() const -> boost::iterator_range <genotype_vector::const_iterator>
+	sample_field variant_base::sample(std::size_t const sample_no) const
 	{
-		auto const begin(m_genotype.cbegin());
-		return boost::make_iterator_range(begin, begin + m_gt_count);
+		always_assert(sample_no < m_ploidies.size());
+		
+		// The samples after the last parsed one are empty.
+		sample_field retval;
+		retval.m_codes = m_gt_codes.data();
+		retval.m_phase_mask = m_phase_mask.data();
+		retval.m_first_slot = sample_no * m_ploidy_stride;
+		retval.m_ploidy = (sample_no < m_sample_count ? m_ploidies[sample_no] : 0);
+		return retval;
+	}
+	
+	
+	void variant_base::clear_sample(std::size_t const sample_no)
+	{
+		m_ploidies[sample_no] = 0;
+		auto const begin(m_gt_codes.begin() + sample_no * m_ploidy_stride);
+		std::fill(begin, begin + m_ploidy_stride, ABSENT_GENOTYPE_CODE);
+	}
+	
+	
+	void variant_base::set_phase_bit(std::size_t const slot, bool const is_phased)
+	{
+		auto &word(m_phase_mask[slot / 64]);
+		uint64_t const mask(uint64_t(1) << (slot % 64));
+		if (is_phased)
+			word |= mask;
+		else
+			word &= ~mask;
+	}
+	
+	
+	void variant_base::set_genotype_code(std::size_t const alt, std::size_t const sample_no, std::size_t const idx)
+	{
+		always_assert(alt < ABSENT_GENOTYPE_CODE, "Unexpected ALT index");
+		
+		// Clear the unused slots when the first value of a sample is set.
+		if (0 == idx)
+			clear_sample(sample_no);
+		
+		m_gt_codes[sample_no * m_ploidy_stride + idx] = alt;
+		m_ploidies[sample_no] = 1 + idx;
+	}
+	
+	
+	// Set both genotype values of the next sample at once, cf. set_gt.
+	void variant_base::set_diploid_gt(std::size_t const alt_1, std::size_t const alt_2, std::size_t const sample_no, bool const is_phased)
+	{
+		// Check that the samples are given in increasing order.
+		always_assert(0 != sample_no);
+		always_assert(m_sample_count <= sample_no);
+		always_assert(2 <= m_ploidy_stride);
+		
+		if (! (sample_no < m_ploidies.size()))
+			reserve_samples(1 + sample_no);
+		
+		// Clear the skipped samples.
+		for (std::size_t i(m_sample_count); i < sample_no; ++i)
+			clear_sample(i);
+		
+		m_sample_count = 1 + sample_no;
+		
+		set_genotype_code(alt_1, sample_no, 0);
+		set_genotype_code(alt_2, sample_no, 1);
+		set_phase_bit(sample_no * m_ploidy_stride, false);
+		set_phase_bit(sample_no * m_ploidy_stride + 1, is_phased);
+		
+		m_is_phased &= is_phased;
+		if (alt_1)
+			m_carriers.push_back(genotype_carrier{sample_no, alt_1, 0});
+		if (alt_2)
+			m_carriers.push_back(genotype_carrier{sample_no, alt_2, 1});
+	}
+	
+	
+	// Set the genotype value of a sample without checking the order, cf. set_gt.
+	void variant_base::set_gt_in_range(std::size_t const alt, std::size_t const sample_no, std::size_t const idx, bool const is_phased)
+	{
+		assert(0 != sample_no);
+		assert(sample_no < m_sample_count);
+		assert(idx < m_ploidy_stride);
+		
+		set_genotype_code(alt, sample_no, idx);
+		
+		// Adjacent samples may share the word.
+		auto const slot(sample_no * m_ploidy_stride + idx);
+		auto &word(m_phase_mask[slot / 64]);
+		uint64_t const mask(uint64_t(1) << (slot % 64));
+		if (is_phased)
+			__atomic_fetch_or(&word, mask, __ATOMIC_RELAXED);
+		else
+			__atomic_fetch_and(&word, ~mask, __ATOMIC_RELAXED);
 	}
 	
 	
@@ -6,11 +6,14 @@
 #ifndef VCF2MULTIALIGN_VARIANT_BUFFER_HH
 #define VCF2MULTIALIGN_VARIANT_BUFFER_HH
 
+#include <atomic>
 #include <boost/container/set.hpp> // For an extract-capable multiset.
-#include <mutex>
+#include <memory>
 #include <string>
 #include <vcf2multialign/dispatch_fn.hh>
+#include <vcf2multialign/spsc_ring.hh>
 #include <vcf2multialign/types.hh>
+#include <vcf2multialign/variant_slab.hh>
 #include <vcf2multialign/vcf_reader.hh>
 
 
@@ -24,10 +27,21 @@ namespace vcf2multialign {
 	};
 	
 	
+	// Pass the parsed variants from the parsing queue to the main queue in batches.
+	// The batches are handed over with a single-producer single-consumer ring and
+	// returned with another one, so that the nodes may be recycled without locking.
+	// The parser waits when too many bytes are in flight.
 	class variant_buffer
 	{
 		friend void swap(variant_buffer &lhs, variant_buffer &rhs);
 		
+	public:
+		enum {
+			BATCH_COUNT			= 64,						// Maximum number of batches in flight.
+			BATCH_SIZE			= 256 * 1024,				// Bytes after which a batch is passed on.
+			MAX_BYTES_IN_FLIGHT	= 64 * 1024 * 1024
+		};
+		
 	protected:
 		struct cmp_variant
 		{
@@ -40,16 +54,55 @@ namespace vcf2multialign {
 		typedef boost::container::multiset <variant, cmp_variant>	variant_set;
 		typedef std::vector <variant_set::node_type>				variant_vector;
 		
+		struct batch
+		{
+			std::vector <variant_set>	groups;				// Variants with the same POS.
+			variant_vector				processed_nodes;	// For returning the nodes to the parsing queue.
+			std::size_t					group_count{0};		// Complete groups.
+			std::size_t					byte_count{0};		// Approximate size of the variants.
+		};
+		
+		typedef std::unique_ptr <batch>	batch_ptr;
+		
+		// Shared by the parsing queue (producer) and the main queue (consumer).
+		struct handoff
+		{
+			spsc_ring <batch_ptr>				filled_batches;
+			spsc_ring <batch_ptr>				empty_batches;
+			dispatch_ptr <dispatch_semaphore_t>	producer_sema;
+			std::atomic_size_t					bytes_in_flight{0};
+			std::atomic_bool					producer_is_waiting{false};
+			std::atomic_bool					consumer_is_scheduled{false};
+			
+			// Statistics for finding out which side is the bottleneck.
+			std::size_t							batch_count{0};				// Updated by the producer.
+			std::size_t							producer_wait_count{0};
+			std::size_t							max_batches_in_flight{0};
+			std::size_t							max_bytes_in_flight{0};
+			std::size_t							consumer_idle_count{0};		// Updated by the consumer.
+			
+			explicit handoff(std::size_t const capacity):
+				filled_batches(capacity),
+				empty_batches(capacity),
+				producer_sema(dispatch_semaphore_create(0), false)
+			{
+			}
+		};
+		
 		// Movable instance variables.
+		// The slab pool is declared first so that the variants are released before it is deallocated.
 		struct data
 		{
+			std::unique_ptr <variant_slab_pool>	m_slab_pool{new variant_slab_pool};
+			std::unique_ptr <handoff>			m_handoff{new handoff(BATCH_COUNT)};
+			variant_slab_ptr					m_current_slab{};		// For the strings of the records being parsed.
+			batch_ptr							m_current_batch{};
 			vcf_reader							*m_reader{};
 			variant_buffer_delegate				*m_delegate{};
 			dispatch_ptr <dispatch_queue_t>		m_main_queue{};
-			dispatch_ptr <dispatch_semaphore_t>	m_process_sema{};
 			variant_set							m_factory;
-			variant_set							m_prepared_variants;
-			variant_vector						m_buffer;
+			variant_vector						m_free_nodes;			// Used by the parsing queue only.
+			std::size_t							m_allocated_batches{0};
 			std::size_t							m_previous_pos{};
 			
 			data() = default;
@@ -61,19 +114,27 @@ namespace vcf2multialign {
 			):
 				m_reader(&reader),
 				m_delegate(&delegate),
-				m_main_queue(main_queue),
-				m_process_sema(dispatch_semaphore_create(10), false)
+				m_main_queue(main_queue)
 			{
 			}
 		};
 		
 	protected:
-		std::mutex							m_buffer_mutex{};
 		data								m_d{};
 		
 	protected:
-		void return_node_to_buffer(variant_set::node_type &&node);
-		bool get_node_from_buffer(variant_set::node_type &node);
+		static std::size_t variant_size(variant const &var);
+		
+		// Called on the parsing queue.
+		bool can_get_empty_batch() const;
+		void get_empty_batch();
+		void close_group();
+		void pass_batch();
+		
+		// Called on the main queue.
+		void process_batches();
+		void process_batch(batch &batch);
+		void finish();
 
 	public:
 		variant_buffer() = default;
@@ -101,8 +162,8 @@ namespace vcf2multialign {
 		}
 		
 		vcf_reader &reader() { return *m_d.m_reader; }
+		void set_reader(vcf_reader &reader) { m_d.m_reader = &reader; }
 		void read_input();
-		void process_input(variant_set &variants);
 		void set_delegate(variant_buffer_delegate &delegate) { m_d.m_delegate = &delegate; }
 	};
 	
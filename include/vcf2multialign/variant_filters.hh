@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_VARIANT_FILTERS_HH
+#define VCF2MULTIALIGN_VARIANT_FILTERS_HH
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	// Dense set of line numbers, e.g. of the variants to be skipped.
+	class variant_set
+	{
+	protected:
+		std::vector <uint64_t>	m_words;
+		std::size_t				m_size{0};
+
+	public:
+		// Return true if the line number was not in the set, cf. std::set::insert.
+		bool insert(std::size_t const lineno)
+		{
+			auto const word_idx(lineno / 64);
+			if (m_words.size() <= word_idx)
+				m_words.resize(1 + word_idx, 0);
+
+			auto &word(m_words[word_idx]);
+			uint64_t const mask(uint64_t(1) << (lineno % 64));
+			if (word & mask)
+				return false;
+
+			word |= mask;
+			++m_size;
+			return true;
+		}
+
+		bool contains(std::size_t const lineno) const
+		{
+			auto const word_idx(lineno / 64);
+			return word_idx < m_words.size() && ((m_words[word_idx] >> (lineno % 64)) & 0x1);
+		}
+
+		std::size_t size() const { return m_size; }
+		bool empty() const { return 0 == m_size; }
+		void clear() { m_words.clear(); m_size = 0; }
+	};
+
+
+	// Set of (one-based) ALT indices. Indices greater than MAX_ALT_IDX are never included,
+	// which agrees with uint8_t being used for the indices elsewhere.
+	class alt_bitmask
+	{
+	public:
+		enum { WORD_COUNT = 4, MAX_ALT_IDX = 64 * WORD_COUNT - 1 };
+
+		// Iterate the indices in the set in increasing order.
+		class const_iterator
+		{
+		public:
+			typedef std::forward_iterator_tag	iterator_category;
+			typedef std::size_t					value_type;
+			typedef std::ptrdiff_t				difference_type;
+			typedef std::size_t const			*pointer;
+			typedef std::size_t					reference;
+
+		protected:
+			alt_bitmask const	*m_mask{nullptr};
+			std::size_t			m_idx{0};
+
+		public:
+			const_iterator() = default;
+
+			const_iterator(alt_bitmask const &mask, std::size_t const idx):
+				m_mask(&mask),
+				m_idx(mask.next(idx))
+			{
+			}
+
+			std::size_t operator*() const { return m_idx; }
+			const_iterator &operator++() { m_idx = m_mask->next(1 + m_idx); return *this; }
+			const_iterator operator++(int) { auto retval(*this); ++(*this); return retval; }
+			bool operator==(const_iterator const &other) const { return m_idx == other.m_idx; }
+			bool operator!=(const_iterator const &other) const { return m_idx != other.m_idx; }
+		};
+
+	protected:
+		std::array <uint64_t, WORD_COUNT>	m_words{};
+
+	protected:
+		// Find the first index in the set starting from idx, or 1 + MAX_ALT_IDX.
+		std::size_t next(std::size_t idx) const
+		{
+			while (idx <= MAX_ALT_IDX)
+			{
+				auto const word(m_words[idx / 64] >> (idx % 64));
+				if (word)
+					return idx + __builtin_ctzll(word);
+
+				idx = 64 * (1 + idx / 64);
+			}
+			return 1 + MAX_ALT_IDX;
+		}
+
+	public:
+		void clear() { m_words.fill(0); }
+
+		// Include the indices 1 to count.
+		void assign_range(std::size_t const count)
+		{
+			clear();
+			auto const end(std::min <std::size_t>(1 + count, 1 + MAX_ALT_IDX));
+			for (std::size_t i(0); 64 * i < end; ++i)
+			{
+				auto const bit_count(std::min <std::size_t>(64, end - 64 * i));
+				m_words[i] = (64 == bit_count ? ~uint64_t(0) : (uint64_t(1) << bit_count) - 1);
+			}
+			m_words[0] &= ~uint64_t(1);
+		}
+
+		void insert(std::size_t const idx)
+		{
+			if (idx <= MAX_ALT_IDX)
+				m_words[idx / 64] |= uint64_t(1) << (idx % 64);
+		}
+
+		bool contains(std::size_t const idx) const
+		{
+			return idx <= MAX_ALT_IDX && ((m_words[idx / 64] >> (idx % 64)) & 0x1);
+		}
+
+		bool empty() const
+		{
+			return std::all_of(m_words.begin(), m_words.end(), [](uint64_t const word){ return 0 == word; });
+		}
+
+		std::size_t size() const
+		{
+			std::size_t retval(0);
+			for (auto const word : m_words)
+				retval += __builtin_popcountll(word);
+			return retval;
+		}
+
+		const_iterator begin() const { return const_iterator(*this, 0); }
+		const_iterator end() const { return const_iterator(*this, 1 + MAX_ALT_IDX); }
+	};
+
+
+	// Valid ALTs of the variants, filled in the analysis pass and only read afterwards.
+	// Only the variants that have ALTs that cannot be handled are stored.
+	class valid_alt_map
+	{
+	protected:
+		variant_set							m_restricted_lines;
+		std::map <std::size_t, alt_bitmask>	m_valid_alts;
+
+	public:
+		void add(std::size_t const lineno, std::size_t const alt_count, alt_bitmask const &valid_alts)
+		{
+			if (valid_alts.size() < alt_count && m_restricted_lines.insert(lineno))
+				m_valid_alts.emplace(lineno, valid_alts);
+		}
+
+		void valid_alts(std::size_t const lineno, std::size_t const alt_count, alt_bitmask &dst) const
+		{
+			if (m_restricted_lines.contains(lineno))
+				dst = m_valid_alts.find(lineno)->second;
+			else
+				dst.assign_range(alt_count);
+		}
+
+		void clear() { m_restricted_lines.clear(); m_valid_alts.clear(); }
+	};
+}
+
+#endif
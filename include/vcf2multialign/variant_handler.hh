@@ -45,11 +45,11 @@ namespace vcf2multialign {
 		
 		variant_buffer									m_variant_buffer;
 		variant_set const								*m_skipped_variants{};
-		std::set <size_t>								m_valid_alts;
+		valid_alt_map const								*m_valid_alt_map{};
+		alt_bitmask										m_valid_alts;
 		
 		sv_handling										m_sv_handling_method{};
 		std::size_t										m_i{0};
-		bool											m_check_alts{true};
 		
 	public:
 		variant_handler(
@@ -59,6 +59,7 @@ namespace vcf2multialign {
 			vector_type const &reference,
 			sv_handling const sv_handling_method,
 			variant_set const &skipped_variants,
+			valid_alt_map const &valid_alts,
 			error_logger &error_logger
 		):
 			m_main_queue(main_queue),
@@ -67,6 +68,7 @@ namespace vcf2multialign {
 			m_reference(&reference),
 			m_variant_buffer(vcf_reader_, main_queue, *this),
 			m_skipped_variants(&skipped_variants),
+			m_valid_alt_map(&valid_alts),
 			m_sv_handling_method(sv_handling_method)
 		{
 		}
@@ -75,26 +77,34 @@ namespace vcf2multialign {
 		
 	public:
 		variant_buffer &get_variant_buffer() { return m_variant_buffer; }
+		dispatch_queue_t main_queue() { return *m_main_queue; }
 		void set_delegate(variant_handler_delegate &delegate) { m_delegate = &delegate; }
-		bool is_valid_alt(uint8_t const alt_idx) const { return 0 < m_valid_alts.count(alt_idx); }
-		std::set <size_t> const &valid_alts() const { return m_valid_alts; }
+		void set_vcf_reader(vcf_reader &reader) { m_variant_buffer.set_reader(reader); }
+		bool is_valid_alt(std::size_t const alt_idx) const { return m_valid_alts.contains(alt_idx); }
+		alt_bitmask const &valid_alts() const { return m_valid_alts; }
 		
 		void process_variants();
-		void enumerate_genotype(
-			variant &var,
-			std::size_t const sample_no,
-			std::function <void(uint8_t, std::size_t, bool)> const &cb
-		);
+		
+		// Call cb with (sample_no, chr_idx, alt_idx) for each non-zero alt_idx in sample order.
+		template <typename t_cb>
+		void enumerate_carriers(variant &var, t_cb &&cb) const;
 		
 
 	protected:
 		virtual void handle_variant(variant &var) override;
 		virtual void finish() override;
 		
-		bool check_alt_seq(std::string const &alt) const;
-		void fill_valid_alts(variant const &var);
-		void set_check_alts(bool const should_check) { m_check_alts = should_check; }
 	};
+	
+	
+	template <typename t_cb>
+	void variant_handler::enumerate_carriers(variant &var, t_cb &&cb) const
+	{
+		// Only the non-reference alleles need to be handled.
+		always_assert(var.is_phased(), "Variant file not phased");
+		for (auto const &carrier : var.carriers())
+			cb(carrier.sample_no, carrier.chr_idx, carrier.alt);
+	}
 }
 
 #endif
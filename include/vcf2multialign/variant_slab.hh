@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_VARIANT_SLAB_HH
+#define VCF2MULTIALIGN_VARIANT_SLAB_HH
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	class variant_slab_pool;
+
+
+	// Storage for the strings of the records passed from the parsing queue to the main queue.
+	// The records refer to the slab with variant_slab_ptr, and the slab is returned
+	// to its pool when the last reference has been released.
+	class variant_slab
+	{
+		friend class variant_slab_pool;
+		friend class variant_slab_ptr;
+
+	protected:
+		std::unique_ptr <char[]>	m_data;
+		std::size_t					m_capacity{0};
+		std::size_t					m_size{0};
+		std::atomic_size_t			m_ref_count{0};
+		variant_slab_pool			*m_pool{nullptr};
+
+	public:
+		variant_slab(variant_slab_pool &pool, std::size_t const capacity):
+			m_data(new char[capacity]),
+			m_capacity(capacity),
+			m_pool(&pool)
+		{
+		}
+
+		std::size_t capacity() const { return m_capacity; }
+		std::size_t available() const { return m_capacity - m_size; }
+
+		// The data is never moved, so the returned view is valid until the slab is recycled.
+		std::string_view append(std::string_view const &str)
+		{
+			assert(str.size() <= available());
+			auto *dst(m_data.get() + m_size);
+			std::copy(str.begin(), str.end(), dst);
+			m_size += str.size();
+			return std::string_view(dst, str.size());
+		}
+	};
+
+
+	class variant_slab_ptr
+	{
+	protected:
+		variant_slab	*m_slab{nullptr};
+
+	protected:
+		void retain() { if (m_slab) m_slab->m_ref_count.fetch_add(1, std::memory_order_relaxed); }
+
+	public:
+		variant_slab_ptr() = default;
+
+		explicit variant_slab_ptr(variant_slab &slab):
+			m_slab(&slab)
+		{
+			retain();
+		}
+
+		variant_slab_ptr(variant_slab_ptr const &other):
+			m_slab(other.m_slab)
+		{
+			retain();
+		}
+
+		variant_slab_ptr(variant_slab_ptr &&other):
+			m_slab(other.m_slab)
+		{
+			other.m_slab = nullptr;
+		}
+
+		~variant_slab_ptr() { reset(); }
+
+		variant_slab_ptr &operator=(variant_slab_ptr other) &
+		{
+			using std::swap;
+			swap(m_slab, other.m_slab);
+			return *this;
+		}
+
+		inline void reset();
+
+		variant_slab *get() const { return m_slab; }
+		variant_slab *operator->() const { return m_slab; }
+		explicit operator bool() const { return nullptr != m_slab; }
+	};
+
+
+	// Recycle the slabs. The pool needs to outlive the records that refer to them.
+	class variant_slab_pool
+	{
+		friend class variant_slab_ptr;
+
+	protected:
+		std::vector <std::unique_ptr <variant_slab>>	m_slabs;
+		std::vector <variant_slab *>					m_available_slabs;
+		std::mutex										m_mutex;
+		std::size_t										m_slab_size{0};
+
+	protected:
+		inline void return_slab(variant_slab &slab);
+
+	public:
+		explicit variant_slab_pool(std::size_t const slab_size = 1024 * 1024):
+			m_slab_size(slab_size)
+		{
+		}
+
+		variant_slab_pool(variant_slab_pool const &) = delete;
+		variant_slab_pool &operator=(variant_slab_pool const &) = delete;
+
+		// Get an empty slab with room for at least min_capacity characters.
+		inline variant_slab_ptr get_slab(std::size_t const min_capacity);
+	};
+
+
+	void variant_slab_ptr::reset()
+	{
+		if (m_slab && 1 == m_slab->m_ref_count.fetch_sub(1, std::memory_order_acq_rel))
+			m_slab->m_pool->return_slab(*m_slab);
+
+		m_slab = nullptr;
+	}
+
+
+	void variant_slab_pool::return_slab(variant_slab &slab)
+	{
+		std::lock_guard <std::mutex> guard(m_mutex);
+		slab.m_size = 0;
+		m_available_slabs.push_back(&slab);
+	}
+
+
+	variant_slab_ptr variant_slab_pool::get_slab(std::size_t const min_capacity)
+	{
+		std::lock_guard <std::mutex> guard(m_mutex);
+
+		// Only records longer than m_slab_size need larger slabs.
+		auto const it(std::find_if(m_available_slabs.rbegin(), m_available_slabs.rend(), [min_capacity](variant_slab const *slab){
+			return min_capacity <= slab->capacity();
+		}));
+
+		if (m_available_slabs.rend() != it)
+		{
+			auto *slab(*it);
+			m_available_slabs.erase(std::next(it).base());
+			return variant_slab_ptr(*slab);
+		}
+
+		auto &slab(m_slabs.emplace_back(new variant_slab(*this, std::max(min_capacity, m_slab_size))));
+		return variant_slab_ptr(*slab);
+	}
+}
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_VCF_INPUT_HH
+#define VCF2MULTIALIGN_VCF_INPUT_HH
+
+#include <condition_variable>
+#include <cstdint>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <vcf2multialign/bgzf_reader.hh>
+#include <vcf2multialign/dispatch_fn.hh>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	// Characters to be handled by the parser.
+	struct vcf_input_range
+	{
+		char const	*p{nullptr};
+		char const	*pe{nullptr};
+		char const	*eof{nullptr};
+	};
+
+
+	class vcf_input
+	{
+	public:
+		virtual ~vcf_input() {}
+
+		// Read one line of the header. Return false on EOF.
+		virtual bool getline(std::string &dst) = 0;
+
+		// Called after reading the header.
+		virtual void store_first_variant_offset() = 0;
+		virtual void reset_to_first_variant_offset() = 0;
+		
+		// Offsets for line indices, i.e. byte offsets or BGZF virtual offsets. Return false if not supported.
+		virtual bool tell(std::uint64_t &offset) { return false; }
+		virtual bool set_first_variant_offset(std::uint64_t const offset) { return false; }
+
+		// Make range point to complete lines. Set range.eof when the end of the input has been reached.
+		virtual void fill_buffer(vcf_input_range &range) = 0;
+		
+		// Hints for inputs that copy the data to a buffer. Should be called before reading the variants.
+		virtual void set_preferred_buffer_size(std::size_t const size) {}
+		virtual void set_read_ahead_buffer_count(std::size_t const count) {}
+	};
+
+
+	// Copy the input to buffers. The next buffers are filled in a separate
+	// thread while the current one is being parsed, which also works for
+	// inputs that cannot be memory mapped.
+	class vcf_buffered_input : public vcf_input
+	{
+	protected:
+		struct chunk
+		{
+			std::vector <char>	data;
+			std::size_t			prefix_size{0};		// Space reserved for the incomplete line of the previous chunk.
+			std::size_t			size{0};			// Number of characters read after the prefix.
+			bool				at_eof{false};
+		};
+
+	protected:
+		std::vector <chunk>				m_chunks;
+		std::vector <char>				m_long_line_buffer;		// Lines that do not fit in the prefix.
+		dispatch_ptr <dispatch_group_t>	m_read_group{};
+		std::mutex						m_mutex{};
+		std::condition_variable			m_cv{};
+		char const						*m_remainder{nullptr};	// Incomplete line at the end of the current range.
+		std::size_t						m_remainder_size{0};
+		std::size_t						m_chunk_size{1024 * 1024};
+		std::size_t						m_prefix_size{64 * 1024};
+		std::size_t						m_current_chunk{SIZE_MAX};	// Chunk that contains the current range.
+		std::size_t						m_next_chunk{0};
+		std::size_t						m_filled_count{0};		// Protected by m_mutex.
+		std::size_t						m_free_count{0};		// Protected by m_mutex.
+		bool							m_should_stop{false};	// Protected by m_mutex.
+		bool							m_is_reading{false};
+		bool							m_reached_eof{false};
+		bool							m_remainder_is_in_long_line_buffer{false};
+
+	protected:
+		static void read_chunks(void *ctx);
+
+		// Read at most len characters. Set at_eof if the end of the input was reached.
+		// Called from the reading thread.
+		virtual std::size_t read(char *dst, std::size_t const len, bool &at_eof) = 0;
+
+		void start_reading();
+		chunk &wait_for_chunk();
+		void release_chunk(std::size_t const idx);
+		void move_remainder_to_long_line_buffer();
+
+		// Should be called before changing the read position and in the subclass destructor.
+		void stop_reading();
+		void reset_buffer() { stop_reading(); m_reached_eof = false; }
+
+	public:
+		vcf_buffered_input():
+			m_chunks(2),
+			m_read_group(dispatch_group_create())
+		{
+		}
+
+		void fill_buffer(vcf_input_range &range) override;
+		void set_preferred_buffer_size(std::size_t const size) override;
+		void set_read_ahead_buffer_count(std::size_t const count) override;
+	};
+
+
+	// Read from a stream.
+	class vcf_stream_input final : public vcf_buffered_input
+	{
+	protected:
+		std::istream			*m_stream{nullptr};
+		std::istream::pos_type	m_first_variant_offset{0};
+
+	protected:
+		std::size_t read(char *dst, std::size_t const len, bool &at_eof) override;
+
+	public:
+		vcf_stream_input(std::istream &stream):
+			m_stream(&stream)
+		{
+		}
+
+		~vcf_stream_input() { stop_reading(); }
+
+		bool getline(std::string &dst) override;
+		void store_first_variant_offset() override;
+		void reset_to_first_variant_offset() override;
+		bool tell(std::uint64_t &offset) override;
+		bool set_first_variant_offset(std::uint64_t const offset) override { m_first_variant_offset = offset; return true; }
+	};
+
+
+	// Read a BGZF compressed file. Offsets are virtual file offsets.
+	class vcf_bgzf_input final : public vcf_buffered_input
+	{
+	protected:
+		bgzf_reader								m_reader;
+		bgzf_reader::virtual_offset_type		m_first_variant_offset{0};
+
+	protected:
+		std::size_t read(char *dst, std::size_t const len, bool &at_eof) override { return m_reader.read(dst, len, at_eof); }
+
+	public:
+		~vcf_bgzf_input() { stop_reading(); }
+
+		// Takes ownership of the file descriptor.
+		void open(int const fd) { m_reader.open(fd); }
+
+		bool getline(std::string &dst) override { return m_reader.getline(dst); }
+		void store_first_variant_offset() override { m_first_variant_offset = m_reader.tell(); }
+		void reset_to_first_variant_offset() override;
+		bool tell(std::uint64_t &offset) override { offset = m_reader.tell(); return true; }
+
+		// Start each pass from the given record, e.g. one found with a tabix index.
+		bool set_first_variant_offset(bgzf_reader::virtual_offset_type const offset) override { m_first_variant_offset = offset; return true; }
+	};
+
+
+	// Parse the memory mapped file directly.
+	class vcf_mmap_input final : public vcf_input
+	{
+	protected:
+		char const				*m_data{nullptr};
+		std::size_t				m_size{0};
+		std::size_t				m_first_variant_offset{0};
+		std::size_t				m_pos{0};
+
+	public:
+		vcf_mmap_input() = default;
+		vcf_mmap_input(vcf_mmap_input const &) = delete;
+		vcf_mmap_input &operator=(vcf_mmap_input const &) = delete;
+		~vcf_mmap_input();
+
+		// Map the given file. Return false and leave errno set on failure.
+		bool open(int const fd);
+
+		bool getline(std::string &dst) override;
+		void store_first_variant_offset() override;
+		void reset_to_first_variant_offset() override;
+		void fill_buffer(vcf_input_range &range) override;
+		bool tell(std::uint64_t &offset) override { offset = m_pos; return true; }
+		bool set_first_variant_offset(std::uint64_t const offset) override;
+	};
+}
+
+#endif
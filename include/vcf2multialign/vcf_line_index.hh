@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_VCF_LINE_INDEX_HH
+#define VCF2MULTIALIGN_VCF_LINE_INDEX_HH
+
+#include <cstdint>
+#include <string>
+#include <vcf2multialign/vcf_input.hh>
+#include <vcf2multialign/vcf_reader.hh>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	// Sampled mapping from line numbers and positions to input offsets.
+	// Stored next to the variant file so that a pass may be started in the
+	// middle of the file while keeping the line numbers of the records.
+	class vcf_line_index
+	{
+	public:
+		struct entry
+		{
+			std::uint64_t	offset{0};		// Byte offset or BGZF virtual offset of the line.
+			std::uint64_t	lineno{0};
+			std::uint64_t	pos{0};
+			std::uint32_t	chrom_idx{0};	// Index in m_chrom_names.
+		};
+
+	protected:
+		std::vector <std::string>	m_chrom_names;		// In order of appearance.
+		std::vector <entry>			m_entries;			// Sorted by line number.
+		std::uint64_t				m_file_size{0};		// Of the variant file, for checking that the index is up to date.
+		std::int64_t				m_file_mtime{0};
+
+	protected:
+		bool read_file_stats(char const *variants_fname);
+
+	public:
+		static std::string index_fname(char const *variants_fname) { return std::string(variants_fname) + ".v2mi"; }
+
+		// Read the records from the current position of the input, i.e. after the header, and add
+		// an entry for each interval-th line and the first line of each chromosome.
+		// Return false if the input does not support offsets.
+		bool build(char const *variants_fname, vcf_input &input, std::size_t const last_header_lineno, std::size_t const interval = 1024);
+
+		// Return false if the index does not exist or does not match the variant file.
+		bool read(char const *variants_fname);
+		bool write(char const *variants_fname) const;
+
+		// Find the last entry from which the records inside the region may be reached.
+		// Return false if the index has no records for the chromosome.
+		bool find_region_start(vcf_region const &region, entry &dst) const;
+
+		std::size_t size() const { return m_entries.size(); }
+	};
+}
+
+#endif
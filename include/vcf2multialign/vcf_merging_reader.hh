@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_VCF_MERGING_READER_HH
+#define VCF2MULTIALIGN_VCF_MERGING_READER_HH
+
+#include <functional>
+#include <memory>
+#include <vcf2multialign/variant.hh>
+#include <vcf2multialign/vcf_reader.hh>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	// Read sample-partitioned variant files, i.e. ones that have the same records
+	// but different samples, in lock-step and pass each record to the callback as
+	// if the samples were in one file. The samples are numbered in the order of the
+	// partitions. The partitions are parsed in parallel in batches of records.
+	class vcf_merging_reader final : public vcf_reader
+	{
+	protected:
+		struct partition
+		{
+			std::unique_ptr <vcf_reader>		reader;
+			std::unique_ptr <vcf_reader_cursor>	cursor;
+			std::vector <persistent_variant>	variants;			// Current batch.
+			std::size_t							variant_count{0};
+			std::size_t							sample_offset{0};	// Added to the sample numbers of the partition.
+		};
+
+	protected:
+		std::vector <partition>			m_partitions;
+		std::vector <genotype_carrier>	m_carriers;					// Buffer for renumbering the carriers.
+		std::size_t						m_batch_size{0};
+		std::size_t						m_batch_pos{0};				// Next record in the current batch.
+		std::size_t						m_batch_count{0};			// Number of records in the current batch.
+		bool							m_at_end{false};
+		bool							m_should_update_partitions{true};
+
+	protected:
+		static void read_partition_batch(void *ctx, std::size_t const idx);
+
+		bool parse_records(callback_fn const &cb) override;
+		bool parse_records(batch_builder &builder) override { return parse_records(callback_fn(std::ref(builder))); }
+		void update_partitions();
+		void read_batches();
+		void check_record(std::size_t const idx) const;
+		void merge_record(std::size_t const idx);
+
+	public:
+		explicit vcf_merging_reader(std::size_t const batch_size = 256):
+			m_batch_size(batch_size)
+		{
+		}
+
+		// The partitions should be added before calling read_header().
+		void add_partition(std::unique_ptr <vcf_reader> &&reader);
+		std::size_t partition_count() const { return m_partitions.size(); }
+
+		void read_header() override;
+		void fill_buffer() override {}		// The partitions are read as needed.
+		void reset() override;
+		
+		// Each partition is parsed on a separate thread in addition to the given number.
+		void set_parser_thread_count(std::size_t const count, std::size_t const min_split_line_length = 0) override;
+	};
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_VCF_PARALLEL_PARSER_HH
+#define VCF2MULTIALIGN_VCF_PARALLEL_PARSER_HH
+
+#include <vcf2multialign/dispatch_fn.hh>
+#include <vcf2multialign/vcf_reader.hh>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	// Split the buffer of a vcf_reader at line boundaries and parse the pieces
+	// in parallel with separate readers. The variants are passed to the callback
+	// in the original order and with the same line numbers as when parsing
+	// serially. The next window of pieces is parsed while the variants of the
+	// current one are being handled.
+	class vcf_parallel_parser
+	{
+	protected:
+		struct piece
+		{
+			vcf_reader						reader;
+			std::vector <transient_variant>	variants;
+			std::size_t						variant_count{0};
+			char const						*begin{nullptr};
+			char const						*end{nullptr};
+			std::size_t						line_count{0};
+		};
+
+		struct window
+		{
+			std::vector <piece>				pieces;
+			std::size_t						piece_count{0};
+			std::size_t						first_lineno{0};	// Line number of the line before the window.
+			std::size_t						last_lineno{0};
+			bool							at_eof{false};
+		};
+
+	protected:
+		vcf_reader							*m_reader{nullptr};
+		dispatch_ptr <dispatch_group_t>		m_group{};
+		window								m_windows[2];
+		std::size_t							m_piece_size{0};
+		bool								m_is_parsing{false};
+
+	protected:
+		static void count_lines(void *ctx, std::size_t const idx);
+		static void parse_piece(void *ctx, std::size_t const idx);
+		static void parse_window(void *ctx);
+
+		void prepare_window(window &win, std::size_t const first_lineno);
+		void start_parsing(window &win);
+		void wait_for_parsing();
+
+	public:
+		// Each thread handles approximately piece_size characters at a time.
+		vcf_parallel_parser(vcf_reader &reader, std::size_t const thread_count, std::size_t const piece_size = 256 * 1024);
+		~vcf_parallel_parser() { wait_for_parsing(); }
+
+		vcf_parallel_parser(vcf_parallel_parser const &) = delete;
+		vcf_parallel_parser &operator=(vcf_parallel_parser const &) = delete;
+
+		std::size_t piece_size() const { return m_piece_size; }
+		std::size_t window_size() const { return m_windows[0].pieces.size() * m_piece_size; }
+
+		// Parse the reader's current buffer. Return false if the end of the input was reached.
+		bool parse(vcf_reader::callback_fn const &cb);
+	};
+}
+
+#endif
@@ -6,87 +6,256 @@
 #ifndef VCF2MULTIALIGN_VCF_READER_HH
 #define VCF2MULTIALIGN_VCF_READER_HH
 
-#include <istream>
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
+#include <string>
+#include <string_view>
 #include <vector>
+#include <vcf2multialign/structural_index.hh>
 #include <vcf2multialign/variant.hh>
+#include <vcf2multialign/vcf_input.hh>
 
 
 namespace vcf2multialign {
 	
+	class vcf_parallel_parser;
+	class vcf_reader_cursor;
+	class vcf_wide_line_decoder;
+	
+	
+	// Genomic region with one-based, inclusive coordinates.
+	struct vcf_region
+	{
+		std::string	chrom_id;
+		std::size_t	first_pos{1};
+		std::size_t	last_pos{SIZE_MAX};
+		
+		bool is_set() const { return !chrom_id.empty(); }
+		
+		// Parse “chrom”, “chrom:first” or “chrom:first-last”. Return false on failure.
+		bool parse(std::string const &str);
+	};
+	
+	
+	// Parsed records in struct-of-arrays form for handling them in batches.
+	// The strings point to the reader's buffer. Copies of the complete
+	// records are stored only if requested.
+	class vcf_record_batch
+	{
+	protected:
+		std::vector <std::size_t>		m_pos;
+		std::vector <std::size_t>		m_lineno;
+		std::vector <std::uint32_t>		m_ref_size;
+		std::vector <std::uint32_t>		m_alt_count;
+		std::vector <std::string_view>	m_ref;
+		std::vector <transient_variant>	m_variants;
+		std::size_t						m_size{0};
+		std::size_t						m_capacity{0};
+		bool							m_copies_variants{false};
+		
+	public:
+		vcf_record_batch(std::size_t const capacity, bool const copies_variants = false):
+			m_pos(capacity),
+			m_lineno(capacity),
+			m_ref_size(capacity),
+			m_alt_count(capacity),
+			m_ref(capacity),
+			m_variants(copies_variants ? capacity : 0),
+			m_capacity(capacity),
+			m_copies_variants(copies_variants)
+		{
+			always_assert(0 < capacity, "Batch capacity must be positive");
+		}
+		
+		std::size_t size() const							{ return m_size; }
+		std::size_t capacity() const						{ return m_capacity; }
+		bool is_full() const								{ return m_size == m_capacity; }
+		void clear()										{ m_size = 0; }
+		
+		std::size_t const *pos() const						{ return m_pos.data(); }	// One-based.
+		std::size_t const *lineno() const					{ return m_lineno.data(); }
+		std::uint32_t const *ref_size() const				{ return m_ref_size.data(); }
+		std::uint32_t const *alt_count() const				{ return m_alt_count.data(); }
+		std::string_view const *ref() const					{ return m_ref.data(); }
+		transient_variant const &variant(std::size_t const idx) const { assert(m_copies_variants); return m_variants[idx]; }
+		
+		inline void push_back(transient_variant const &var);
+	};
+	
+	
 	class vcf_reader
 	{
+		friend class vcf_parallel_parser;
+		friend class vcf_reader_cursor;
+		friend class vcf_wide_line_decoder;
+		
 	public:
 		typedef std::function <bool(transient_variant const &var)> callback_fn;
+		typedef std::function <bool(vcf_record_batch const &batch)> batch_callback_fn;
 		typedef std::map <std::string, std::size_t> sample_name_map;
 		
 	protected:
-		struct fsm
+		template <typename> struct caller;
+		template <typename> friend struct caller;
+		
+		// Fills the batch and passes it to the callback when full.
+		struct batch_builder
 		{
-			char	*p{nullptr};
-			char	*pe{nullptr};
-			char	*eof{nullptr};
+			vcf_record_batch			*batch{nullptr};
+			batch_callback_fn const		*callback{nullptr};
+			mutable bool				should_stop{false};
+			
+			bool operator()(transient_variant const &var) const;
+			bool flush() const;
 		};
 		
-		template <typename> struct caller;
-		template <typename> friend struct caller;
+		template <vcf_field t_max_field, vcf_field t_field, int t_continue, int t_break, typename t_callback>
+		int check_max_field(int const target, t_callback const &cb);
 		
-		template <int t_continue, int t_break>
-		int check_max_field(vcf_field const field, int const target, callback_fn const &cb);
+		template <int t_continue, int t_break, typename t_callback>
+		int end_record(t_callback const &cb);
 
 		void report_unexpected_character(char const *current_character, int const current_state);
+		void read_column_header(std::string const &line);
+		void reset_parser_state();
+		virtual bool parse_records(callback_fn const &cb);
+		virtual bool parse_records(batch_builder &builder);
+		bool parse_range(callback_fn const &cb);
+		template <typename t_callback> bool dispatch_parse_range(t_callback const &cb);
+		template <vcf_field t_max_field, typename t_callback> bool parse_range(t_callback const &cb);
+		void set_range(char const *p, char const *pe, char const *eof, std::size_t const lineno);
+		void copy_parsing_settings(vcf_reader const &other);
 
 	protected:
-		fsm							m_fsm;
+		vcf_input_range				m_fsm;
 		transient_variant			m_current_variant;
 		sample_name_map				m_sample_names;
-		std::vector <char>			m_buffer;
 		std::vector <format_field>	m_format;
-		std::istream				*m_stream{nullptr};
-		char						*m_line_start{nullptr};		// Current line start.
+		std::string					m_format_string;			// Parsed into m_format.
+		std::vector <std::size_t>	m_skipped_sample_runs;		// Number of consecutive samples to be skipped from each sample number, empty if all samples are parsed.
+		structural_index			m_structural_index;
+		vcf_input					*m_input{nullptr};
+		std::vector <std::size_t> const	*m_line_numbers{nullptr};	// Original line numbers of the records, e.g. before sorting.
+		std::unique_ptr <vcf_parallel_parser>	m_parallel_parser;
+		std::unique_ptr <vcf_wide_line_decoder>	m_wide_line_decoder;
+		char const					*m_line_start{nullptr};		// Current line start.
 		char const					*m_start{0};				// Current string start.
-		std::istream::pos_type		m_first_variant_offset{0};
-		std::size_t					m_last_header_lineno{0};
+		std::size_t					m_last_header_lineno{0};	// Line before the first record of each pass.
 		std::size_t					m_lineno{0};
 		std::size_t					m_sample_idx{0};			// Current sample idx (1-based).
+		std::size_t					m_last_parsed_sample{SIZE_MAX};
 		std::size_t					m_idx{0};					// Current index in multi-part fields.
-		std::size_t					m_len{0};
-		std::size_t					m_pos{0};
 		std::size_t					m_format_idx{0};
+		std::size_t					m_format_gt_idx{SIZE_MAX};	// Index of GT in m_format or SIZE_MAX.
 		std::size_t					m_integer{0};				// Currently read from the input.
 		sv_type						m_alt_sv{sv_type::NONE};	// Current ALT structural variant type.
+		vcf_region					m_region;
 		vcf_field					m_max_parsed_field{};
 		bool						m_gt_is_phased{false};		// Is the current GT phased.
+		bool						m_format_is_gt_only{false};	// Does FORMAT consist of GT only.
 		bool						m_alt_is_complex{false};	// Is the current ALT “complex” (includes *).
+		bool						m_region_started{false};	// Has a record on the region's chromosome been seen.
+		bool						m_region_end_reached{false};
+		bool						m_is_parsing_serially{false};	// Set when the records are pulled one at a time.
 	
 	public:
-		vcf_reader():
-			m_buffer(128)
-		{
-		}
+		vcf_reader();
+		vcf_reader(vcf_input &input);
+		virtual ~vcf_reader();
 		
-		vcf_reader(std::istream &stream):
-			m_buffer(128),
-			m_stream(&stream)
-		{
-		}
+		// The parallel parser and the wide line decoder refer to the reader.
+		vcf_reader(vcf_reader const &) = delete;
+		vcf_reader &operator=(vcf_reader const &) = delete;
+		
+		void set_input(vcf_input &input) { m_input = &input; }
+		virtual void read_header();
+		virtual void fill_buffer();
+		virtual void reset();
 		
-		void set_stream(std::istream &stream) { m_stream = &stream; }
-		void read_header();
-		void fill_buffer();
-		void reset();
+		// Start each pass from the given record, e.g. one found with a line index.
+		// Return false if the input does not support offsets.
+		bool set_first_variant(std::uint64_t const offset, std::size_t const lineno);
 		bool parse(callback_fn &&callback);
 		bool parse(callback_fn const &callback);
 		
+		// Pass the records to the callback in batches of at most batch.capacity() records.
+		// The strings in the batch are valid until the callback returns.
+		bool parse(vcf_record_batch &batch, batch_callback_fn const &callback);
+		
 		std::size_t lineno() const { return m_lineno; }
+		
+		// Report the given line numbers instead of counting the lines, e.g. if the records were sorted.
+		void set_line_numbers(std::vector <std::size_t> const &line_numbers) { m_line_numbers = &line_numbers; }
 		size_t sample_no(std::string const &sample_name) const;
 		size_t sample_count() const { return m_sample_names.size(); }
 		sample_name_map const &sample_names() const { return m_sample_names; }
-		void set_parsed_fields(vcf_field max_field) { m_max_parsed_field = max_field; }
+		vcf_region const &region() const { return m_region; }
+		void set_parsed_fields(vcf_field max_field);
+		
+		// Parse large buffers with the given number of threads. If min_split_line_length is non-zero,
+		// split the samples of the lines at least that long between the threads instead of parsing
+		// multiple lines in parallel.
+		virtual void set_parser_thread_count(std::size_t const count, std::size_t const min_split_line_length = 0);
+		
+		// Parse only the samples the numbers of which are set in the mask.
+		// The genotypes of the other samples are cleared, and the line is not
+		// scanned further after the last requested sample.
+		void set_parsed_samples(std::vector <bool> const &mask);
+		void parse_all_samples() { m_skipped_sample_runs.clear(); m_last_parsed_sample = SIZE_MAX; }
+		
+		// Pass only the records that are completely inside the given region to the callback.
+		// The records are expected to be sorted by position.
+		void set_region(vcf_region const &region);
 		
 	protected:
+		std::size_t original_lineno() const { return m_line_numbers ? (*m_line_numbers)[m_lineno] : m_lineno; }
 		void skip_to_next_nl();
+		void skip_samples(std::size_t const count);
+		void skip_sample_fields(std::size_t const idx);
+		void read_format();
+		bool decode_diploid_genotypes();
+		bool decode_wide_line();
+		bool parse_next(transient_variant const *&dst);
+	};
+	
+	
+	// Pull the records one at a time instead of passing them to a callback.
+	// The buffer is filled as needed, so the do-while loop around fill_buffer()
+	// and parse() is not required. Stopping early only requires not calling next().
+	class vcf_reader_cursor
+	{
+	protected:
+		vcf_reader	*m_reader{nullptr};
+		bool		m_should_fill_buffer{true};
+		bool		m_at_end{false};
+		
+	public:
+		// The reader should have been reset.
+		explicit vcf_reader_cursor(vcf_reader &reader):
+			m_reader(&reader)
+		{
+		}
+		
+		// Return the next record or nullptr after the last one. The record and the
+		// strings it refers to remain valid until next() is called again.
+		transient_variant const *next();
 	};
+	
+	
+	void vcf_record_batch::push_back(transient_variant const &var)
+	{
+		assert(m_size < m_capacity);
+		m_pos[m_size] = var.pos();
+		m_lineno[m_size] = var.lineno();
+		m_ref[m_size] = var.ref();
+		m_ref_size[m_size] = var.ref().size();
+		m_alt_count[m_size] = var.alts().size();
+		if (m_copies_variants)
+			m_variants[m_size] = var;
+		++m_size;
+	}
 }
 
 #endif
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_VCF_SORTER_HH
+#define VCF2MULTIALIGN_VCF_SORTER_HH
+
+#include <cstdint>
+#include <string>
+#include <vcf2multialign/vcf_input.hh>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	// Sort the records of a VCF file by POS using a bounded amount of memory.
+	// The records are read into runs that are sorted in memory and written to
+	// temporary files, after which the runs are merged. To limit the number of
+	// open files, runs are merged into longer ones already while reading.
+	class vcf_sorter
+	{
+	public:
+		enum {
+			MERGE_FAN_IN		= 8,					// Number of runs merged into a longer one at a time.
+			MAX_RUN_COUNT		= 32,					// Number of runs kept open at most.
+			DESCRIPTOR_COUNT	= 1 + MAX_RUN_COUNT		// Including the output of a merge.
+		};
+
+	protected:
+		struct record
+		{
+			std::uint64_t	pos{0};
+			std::uint64_t	lineno{0};
+			std::size_t		offset{0};		// In m_data.
+			std::size_t		length{0};		// Including the newline.
+		};
+
+		struct run
+		{
+			int				fd{-1};
+			std::size_t		level{0};		// Number of merges.
+		};
+
+		class run_reader;
+
+	protected:
+		std::string				m_data;
+		std::vector <record>	m_records;
+		std::vector <run>		m_runs;
+		std::size_t				m_buffer_size{0};
+
+	protected:
+		void sort_records();
+		void write_run();
+		void add_run(int const fd, std::size_t const level);
+		void merge_last_runs();
+		template <typename t_fn> void merge_runs(std::size_t const first, t_fn &&fn);
+
+	public:
+		// Each run consists of approximately buffer_size characters.
+		explicit vcf_sorter(std::size_t const buffer_size):
+			m_buffer_size(buffer_size)
+		{
+		}
+
+		~vcf_sorter();
+
+		vcf_sorter(vcf_sorter const &) = delete;
+		vcf_sorter &operator=(vcf_sorter const &) = delete;
+
+		// Read the records from the current position of the input, i.e. after the header,
+		// and write them to dst_fd. Records with equal positions retain their order.
+		// line_numbers[i] will be the original number of the line that is the i-th line
+		// of the output when the lines are counted from last_header_lineno + 1.
+		void sort(vcf_input &input, std::size_t const last_header_lineno, int const dst_fd, std::vector <std::size_t> &line_numbers);
+	};
+}
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_VCF_SPOOL_READER_HH
+#define VCF2MULTIALIGN_VCF_SPOOL_READER_HH
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vcf2multialign/variant.hh>
+#include <vcf2multialign/vcf_reader.hh>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	// Read the records of a variant file that cannot be read again, e.g. a pipe,
+	// only once. Each record is parsed from the source with all of its fields and
+	// samples and written to an unlinked temporary file in a compact binary form.
+	// The passes read the records from the spool and continue with the source when
+	// they reach its end.
+	class vcf_spool_reader final : public vcf_reader
+	{
+	protected:
+		std::unique_ptr <vcf_reader>	m_source;
+		std::vector <char>				m_buffer;				// Encoded records of the current range.
+		std::vector <genotype_carrier>	m_carriers;				// Buffer for decoding the genotypes.
+		std::size_t						m_buffer_pos{0};		// Next record in m_buffer.
+		std::size_t						m_read_size{0};			// Preferred amount of data read from the spool at a time.
+		std::uint64_t					m_spool_size{0};
+		std::uint64_t					m_read_offset{0};		// Next record of the current pass in the spool.
+		int								m_spool_fd{-1};
+		bool							m_source_at_end{false};
+
+	protected:
+		bool parse_records(callback_fn const &cb) override;
+		bool parse_records(batch_builder &builder) override { return parse_records(callback_fn(std::ref(builder))); }
+		void read_from_spool();
+		void read_from_source();
+		void decode_record(char const *data);
+
+	public:
+		explicit vcf_spool_reader(std::unique_ptr <vcf_reader> &&source, std::size_t const read_size = 1024 * 1024);
+		~vcf_spool_reader();
+
+		void read_header() override;
+		void fill_buffer() override;
+		void reset() override;
+		void set_parser_thread_count(std::size_t const count, std::size_t const min_split_line_length = 0) override;
+	};
+}
+
+#endif
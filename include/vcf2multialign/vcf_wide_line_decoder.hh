@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2017 Tuukka Norri
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef VCF2MULTIALIGN_VCF_WIDE_LINE_DECODER_HH
+#define VCF2MULTIALIGN_VCF_WIDE_LINE_DECODER_HH
+
+#include <vcf2multialign/variant.hh>
+#include <vector>
+
+
+namespace vcf2multialign {
+
+	class vcf_reader;
+
+
+	// Split the sample section of a long line at tabs and decode the segments
+	// in parallel into disjoint ranges of the current variant's samples.
+	// CHROM to FORMAT are parsed by the reader, and FORMAT should consist of GT only.
+	class vcf_wide_line_decoder
+	{
+	protected:
+		struct segment
+		{
+			std::vector <genotype_carrier>	carriers;
+			char const						*begin{nullptr};			// First character of the first sample.
+			char const						*end{nullptr};				// After the separator of the last sample.
+			std::size_t						first_sample_no{0};
+			std::size_t						sample_count{0};
+			bool							is_phased{true};
+			bool							is_valid{true};
+		};
+
+	protected:
+		vcf_reader				*m_reader{nullptr};
+		std::vector <segment>	m_segments;
+		std::size_t				m_segment_count{0};
+		std::size_t				m_last_sample_no{0};		// Last sample decoded from the current line.
+		std::size_t				m_min_line_length{0};
+
+	protected:
+		static void count_samples(void *ctx, std::size_t const idx);
+		static void decode_segment(void *ctx, std::size_t const idx);
+
+		void prepare_segments(char const *sample_sep, char const *nl);
+		bool decode_sample(segment &seg, char const *&p, std::size_t const sample_no);
+
+	public:
+		// Split the lines the sample sections of which have at least min_line_length characters
+		// into approximately four segments per thread.
+		vcf_wide_line_decoder(vcf_reader &reader, std::size_t const thread_count, std::size_t const min_line_length);
+
+		vcf_wide_line_decoder(vcf_wide_line_decoder const &) = delete;
+		vcf_wide_line_decoder &operator=(vcf_wide_line_decoder const &) = delete;
+
+		std::size_t min_line_length() const { return m_min_line_length; }
+
+		// Decode the samples between the separator before the first sample and the newline.
+		// Return false if some sample could not be decoded, in which case the samples of
+		// the current variant are cleared.
+		bool decode(char const *sample_sep, char const *nl);
+	};
+}
+
+#endif
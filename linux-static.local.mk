@@ -10,4 +10,8 @@ DOT					= dot
 BOOST_ROOT			= /home/tnorri/local/boost-1-64-0-g++-7.1
 BOOST_INCLUDE		= -I$(BOOST_ROOT)/include
 BOOST_LIBS			= -L$(BOOST_ROOT)/lib -lboost_iostreams
+ZLIB_LIBS			= -lz
+
+# Enable e.g. the AVX2 and BMI2 code paths of the VCF parser.
+#ARCH_FLAGS			= -march=native
 LIBDISPATCH_LIBS	= ../lib/libdispatch/libdispatch-build/src/libdispatch.a ../lib/libpwq/libpwq-build/libpthread_workqueue.a /usr/lib/libkqueue.a -lpthread -static-libstdc++ -static-libgcc
@@ -0,0 +1,570 @@
+/*
+ Copyright (c) 2017 Tuukka Norri
+ This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <unistd.h>
+#include <vcf2multialign/bcf_reader.hh>
+#include <vcf2multialign/util.hh>
+
+
+namespace {
+
+	enum {
+		BCF_FIXED_SHARED_LENGTH	= 24,	// CHROM, POS, rlen, QUAL, n_allele_info, n_fmt_sample.
+
+		BCF_TYPE_MISSING		= 0,
+		BCF_TYPE_INT8			= 1,
+		BCF_TYPE_INT16			= 2,
+		BCF_TYPE_INT32			= 3,
+		BCF_TYPE_FLOAT			= 5,
+		BCF_TYPE_CHAR			= 7
+	};
+
+
+	struct bcf_type
+	{
+		std::uint8_t	type{0};
+		std::size_t		count{0};
+	};
+
+
+	template <typename t_int>
+	t_int read_le(char const *data)
+	{
+		auto const *d(reinterpret_cast <unsigned char const *>(data));
+		typename std::make_unsigned <t_int>::type retval(0);
+		for (std::size_t i(0); i < sizeof(t_int); ++i)
+			retval |= decltype(retval)(d[i]) << (8 * i);
+		return retval;
+	}
+
+
+	std::size_t type_size(std::uint8_t const type)
+	{
+		switch (type)
+		{
+			case BCF_TYPE_MISSING:
+				return 0;
+
+			case BCF_TYPE_INT8:
+			case BCF_TYPE_CHAR:
+				return 1;
+
+			case BCF_TYPE_INT16:
+				return 2;
+
+			case BCF_TYPE_INT32:
+			case BCF_TYPE_FLOAT:
+				return 4;
+
+			default:
+				vcf2multialign::fail("Unexpected BCF type");
+		}
+		return 0;
+	}
+
+
+	std::int64_t read_int(std::uint8_t const type, char const *data)
+	{
+		switch (type)
+		{
+			case BCF_TYPE_INT8:
+				return read_le <std::int8_t>(data);
+
+			case BCF_TYPE_INT16:
+				return read_le <std::int16_t>(data);
+
+			case BCF_TYPE_INT32:
+				return read_le <std::int32_t>(data);
+
+			default:
+				vcf2multialign::fail("Expected an integer");
+		}
+		return 0;
+	}
+
+
+	std::int64_t read_typed_int(char const *&p);
+
+
+	// Read a type descriptor and advance p.
+	bcf_type read_type(char const *&p)
+	{
+		std::uint8_t const desc(*p++);
+		bcf_type retval;
+		retval.type = desc & 0xf;
+		retval.count = desc >> 4;
+
+		// The actual count follows as a typed integer.
+		if (15 == retval.count)
+			retval.count = read_typed_int(p);
+
+		return retval;
+	}
+
+
+	std::int64_t read_typed_int(char const *&p)
+	{
+		auto const type(read_type(p));
+		vcf2multialign::always_assert(1 == type.count, "Expected an integer");
+		auto const retval(read_int(type.type, p));
+		p += type_size(type.type);
+		return retval;
+	}
+
+
+	std::string_view read_typed_string(char const *&p)
+	{
+		auto const type(read_type(p));
+		vcf2multialign::always_assert(BCF_TYPE_CHAR == type.type || 0 == type.count, "Expected a string");
+		std::string_view retval(p, strnlen(p, type.count));	// May be padded with NULs.
+		p += type.count * type_size(type.type);
+		return retval;
+	}
+
+
+	// Determine the structural variant type of the ALT like the VCF parser.
+	vcf2multialign::sv_type alt_sv_type(std::string_view const &alt)
+	{
+		typedef vcf2multialign::sv_type sv_type;
+
+		if (alt.empty() || '<' != alt.front())
+			return sv_type::NONE;
+
+		auto const id(alt.substr(1));
+		auto const starts_with([&id](char const *prefix) {
+			auto const len(std::strlen(prefix));
+			return (len < id.size() && 0 == id.compare(0, len, prefix) && (':' == id[len] || '>' == id[len]));
+		});
+
+		if (starts_with("DUP:TANDEM"))	return sv_type::DUP_TANDEM;
+		if (starts_with("DEL:ME"))		return sv_type::DEL_ME;
+		if (starts_with("INS:ME"))		return sv_type::INS_ME;
+		if (starts_with("DEL"))			return sv_type::DEL;
+		if (starts_with("INS"))			return sv_type::INS;
+		if (starts_with("DUP"))			return sv_type::DUP;
+		if (starts_with("INV"))			return sv_type::INV;
+		if (starts_with("CNV"))			return sv_type::CNV;
+		return sv_type::UNKNOWN;
+	}
+
+
+	// Call fn(key, value) for each attribute of a structured header line, e.g. ##FORMAT=<ID=GT,Number=1,…>.
+	template <typename t_fn>
+	void for_each_header_attribute(std::string_view const &line, t_fn &&fn)
+	{
+		auto pos(line.find('<'));
+		if (std::string_view::npos == pos)
+			return;
+
+		++pos;
+		while (pos < line.size())
+		{
+			auto const eq_pos(line.find('=', pos));
+			if (std::string_view::npos == eq_pos)
+				return;
+
+			auto const key(line.substr(pos, eq_pos - pos));
+			pos = 1 + eq_pos;
+			auto end(pos);
+			if (pos < line.size() && '"' == line[pos])
+			{
+				// Skip the quoted string.
+				++end;
+				while (end < line.size() && '"' != line[end])
+					end += ('\\' == line[end] ? 2 : 1);
+				end = std::min(1 + end, line.size());
+			}
+			else
+			{
+				end = std::min(line.find_first_of(",>", pos), line.size());
+			}
+
+			fn(key, line.substr(pos, end - pos));
+
+			if (! (end < line.size()) || '>' == line[end])
+				return;
+
+			pos = 1 + end;
+		}
+	}
+
+
+	inline std::size_t allele_index(std::int64_t const value)
+	{
+		// Values are (allele + 1) << 1 | phased; zero denotes a missing allele.
+		auto const allele(value >> 1);
+		return (0 < allele ? allele - 1 : vcf2multialign::NULL_ALLELE);
+	}
+}
+
+
+namespace vcf2multialign {
+
+	bool is_bcf(int const fd)
+	{
+		// The reader closes its descriptor. Since it uses pread, the file offset is not changed.
+		int const dup_fd(dup(fd));
+		if (-1 == dup_fd)
+			return false;
+
+		bgzf_reader reader(65536);
+		reader.open(dup_fd);
+
+		char magic[4]{};
+		bool at_eof(false);
+		std::size_t len(0);
+		while (len < sizeof(magic) && !at_eof)
+			len += reader.read(magic + len, sizeof(magic) - len, at_eof);
+
+		return (sizeof(magic) == len && 0 == std::memcmp(magic, "BCF\2", 4));
+	}
+
+
+	// Read exactly len characters.
+	void bcf_reader::read_bytes(char *dst, std::size_t const len)
+	{
+		std::size_t pos(0);
+		bool at_eof(false);
+		while (pos < len && !at_eof)
+			pos += m_reader.read(dst + pos, len - pos, at_eof);
+
+		always_assert(pos == len, "Truncated BCF file");
+	}
+
+
+	void bcf_reader::read_header()
+	{
+		char magic[5];
+		read_bytes(magic, sizeof(magic));
+		always_assert(0 == std::memcmp(magic, "BCF\2", 4), "Unexpected BCF magic number");
+
+		char len_buffer[4];
+		read_bytes(len_buffer, sizeof(len_buffer));
+		std::string text(read_le <std::uint32_t>(len_buffer), '\0');
+		read_bytes(&text[0], text.size());
+
+		// The text is NUL-terminated.
+		text.resize(strnlen(text.data(), text.size()));
+
+		// PASS is always the first entry of the string dictionary.
+		std::map <std::string, std::size_t> strings;
+		strings.emplace("PASS", 0);
+
+		std::string line;
+		std::size_t pos(0);
+		while (pos < text.size())
+		{
+			auto const nl_pos(std::min(text.find('\n', pos), text.size()));
+			line.assign(text, pos, nl_pos - pos);
+			pos = 1 + nl_pos;
+			++m_lineno;
+
+			if (! ('#' == line[0] && '#' == line[1]))
+				break;
+
+			read_dictionaries(line, strings);
+		}
+
+		read_column_header(line);
+
+		m_first_variant_offset = m_reader.tell();
+		m_last_header_lineno = m_lineno;
+	}
+
+
+	// Assign indices to the sequence names and to the FILTER, INFO and FORMAT keys.
+	void bcf_reader::read_dictionaries(std::string const &header_line, std::map <std::string, std::size_t> &strings)
+	{
+		std::string_view const line(header_line);
+		bool const is_contig(0 == line.compare(0, 10, "##contig=<"));
+		bool const is_format(0 == line.compare(0, 10, "##FORMAT=<"));
+		if (! (is_contig || is_format || 0 == line.compare(0, 10, "##FILTER=<") || 0 == line.compare(0, 8, "##INFO=<")))
+			return;
+
+		std::string id;
+		std::size_t idx(SIZE_MAX);
+		for_each_header_attribute(line, [&id, &idx](std::string_view const &key, std::string_view const &value) {
+			if ("ID" == key)
+				id = std::string(value);
+			else if ("IDX" == key)
+				idx = std::strtoull(std::string(value).c_str(), nullptr, 10);
+		});
+
+		if (id.empty())
+			return;
+
+		if (is_contig)
+		{
+			if (SIZE_MAX == idx)
+				idx = m_contig_names.size();
+
+			if (! (idx < m_contig_names.size()))
+				m_contig_names.resize(1 + idx);
+
+			m_contig_names[idx] = id;
+			return;
+		}
+
+		// The same key may be used by e.g. INFO and FORMAT.
+		auto const res(strings.emplace(id, (SIZE_MAX == idx ? strings.size() : idx)));
+		if (is_format && "GT" == id)
+			m_gt_key = res.first->second;
+	}
+
+
+	bool bcf_reader::contig_index(std::string const &name, std::size_t &idx) const
+	{
+		auto const it(std::find(m_contig_names.cbegin(), m_contig_names.cend(), name));
+		if (m_contig_names.cend() == it)
+			return false;
+
+		idx = it - m_contig_names.cbegin();
+		return true;
+	}
+
+
+	void bcf_reader::reset()
+	{
+		m_reader.seek(m_first_variant_offset);
+		m_len = 0;
+		m_pos = 0;
+		m_at_eof = false;
+		reset_parser_state();
+	}
+
+
+	void bcf_reader::fill_buffer()
+	{
+		// Copy the incomplete record to the beginning.
+		char *data(m_buffer.data());
+		std::copy(data + m_pos, data + m_len, data);
+		m_len -= m_pos;
+		m_pos = 0;
+
+		while (true)
+		{
+			if (!m_at_eof && m_len < m_buffer.size())
+				m_len += m_reader.read(m_buffer.data() + m_len, m_buffer.size() - m_len, m_at_eof);
+
+			// Find the end of the last complete record.
+			data = m_buffer.data();
+			while (2 * sizeof(std::uint32_t) <= m_len - m_pos)
+			{
+				auto const shared_len(read_le <std::uint32_t>(data + m_pos));
+				auto const indiv_len(read_le <std::uint32_t>(data + m_pos + 4));
+				std::size_t const record_len(8 + shared_len + indiv_len);
+				if (m_len - m_pos < record_len)
+					break;
+
+				m_pos += record_len;
+			}
+
+			if (m_pos || m_at_eof)
+				break;
+
+			// Make room for at least one record.
+			if (m_len == m_buffer.size())
+				m_buffer.resize(2 * m_buffer.size());
+		}
+
+		always_assert(!m_at_eof || m_pos == m_len, "Truncated BCF record");
+
+		m_fsm.p = data;
+		m_fsm.pe = data + m_pos;
+		m_fsm.eof = (m_at_eof ? m_fsm.pe : nullptr);
+	}
+
+
+	bool bcf_reader::parse_records(callback_fn const &cb)
+	{
+		while (m_fsm.p != m_fsm.pe)
+		{
+			char const *record(m_fsm.p);
+			auto const shared_len(read_le <std::uint32_t>(record));
+			auto const indiv_len(read_le <std::uint32_t>(record + 4));
+			char const *shared(record + 8);
+			char const *indiv(shared + shared_len);
+			char const *end(indiv + indiv_len);
+			m_fsm.p = end;
+
+			++m_lineno;
+			m_current_variant.reset();
+			m_current_variant.set_lineno(m_lineno);
+			decode_shared(shared, indiv);
+
+			if (vcf_field::ALL <= m_max_parsed_field)
+			{
+				auto const format_sample_count(read_le <std::uint32_t>(shared + 20));
+				decode_samples(indiv, end, format_sample_count >> 24, format_sample_count & 0xffffff);
+			}
+
+			if (!cb(m_current_variant))
+				return true;
+		}
+
+		return !m_fsm.eof;
+	}
+
+
+	void bcf_reader::decode_shared(char const *data, char const *end)
+	{
+		always_assert(BCF_FIXED_SHARED_LENGTH <= end - data, "Truncated BCF record");
+
+		auto const chrom(read_le <std::int32_t>(data));
+		always_assert(0 <= chrom && std::size_t(chrom) < m_contig_names.size(), "Unexpected sequence index");
+		m_current_variant.set_chrom_id(m_contig_names[chrom]);
+
+		// Positions are zero-based.
+		m_current_variant.set_pos(1 + read_le <std::int32_t>(data + 4));
+
+		if (vcf_field::QUAL <= m_max_parsed_field)
+		{
+			// Missing values are stored as a signalling NaN.
+			auto const qual_bits(read_le <std::uint32_t>(data + 12));
+			if (0x7f800001 == qual_bits)
+				m_current_variant.set_qual(std::numeric_limits <std::size_t>::max());
+			else
+			{
+				float qual(0);
+				std::memcpy(&qual, &qual_bits, sizeof(qual));
+				m_current_variant.set_qual(std::size_t(qual));
+			}
+		}
+
+		if (m_max_parsed_field < vcf_field::ID)
+			return;
+
+		char const *p(data + BCF_FIXED_SHARED_LENGTH);
+		{
+			auto ids(read_typed_string(p));
+			std::size_t idx(0);
+			while (!ids.empty())
+			{
+				auto const sep_pos(std::min(ids.find(';'), ids.size()));
+				m_current_variant.set_id(ids.substr(0, sep_pos), idx++);
+				ids.remove_prefix(std::min(1 + sep_pos, ids.size()));
+			}
+		}
+
+		if (m_max_parsed_field < vcf_field::REF)
+			return;
+
+		// REF is the first allele.
+		auto const allele_count(read_le <std::uint32_t>(data + 16) >> 16);
+		for (std::size_t i(0); i < allele_count; ++i)
+		{
+			auto const allele(read_typed_string(p));
+			if (0 == i)
+			{
+				m_current_variant.set_ref(allele);
+				if (m_max_parsed_field < vcf_field::ALT)
+					break;
+			}
+			else
+			{
+				m_current_variant.set_alt_sv_type(alt_sv_type(allele), i - 1);
+				m_current_variant.set_alt(allele, i - 1, "*" == allele);
+			}
+		}
+
+		always_assert(p <= end, "Truncated BCF record");
+	}
+
+
+	void bcf_reader::decode_samples(char const *data, char const *end, std::size_t const format_count, std::size_t const sample_count)
+	{
+		always_assert(sample_count == this->sample_count(), "Unexpected number of samples");
+
+		char const *p(data);
+		for (std::size_t i(0); i < format_count; ++i)
+		{
+			auto const key(read_typed_int(p));
+			auto const type(read_type(p));
+			std::size_t const len(type.count * type_size(type.type) * sample_count);
+			always_assert(len <= std::size_t(end - p), "Truncated BCF record");
+
+			if (m_gt_key == std::size_t(key))
+			{
+				switch (type.type)
+				{
+					case BCF_TYPE_INT8:
+						decode_gt <std::int8_t>(p, type.count, sample_count);
+						break;
+
+					case BCF_TYPE_INT16:
+						decode_gt <std::int16_t>(p, type.count, sample_count);
+						break;
+
+					case BCF_TYPE_INT32:
+						decode_gt <std::int32_t>(p, type.count, sample_count);
+						break;
+
+					default:
+						fail("Unexpected GT type");
+				}
+			}
+
+			p += len;
+		}
+	}
+
+
+	// The genotypes are stored as a sample_count × ploidy matrix.
+	template <typename t_int>
+	void bcf_reader::decode_gt(char const *data, std::size_t const ploidy, std::size_t const sample_count)
+	{
+		// Shorter genotypes are padded with the vector end value.
+		t_int const vector_end(std::numeric_limits <t_int>::min() + 1);
+		bool const has_mask(!m_skipped_sample_runs.empty());
+
+		// Sample number 0 is reserved for the reference.
+		std::size_t sample_no(1);
+		while (sample_no <= sample_count)
+		{
+			if (has_mask)
+			{
+				// Stop after the last requested sample and skip the ones that were not requested.
+				if (m_last_parsed_sample < sample_no)
+					break;
+
+				auto const skip_count(m_skipped_sample_runs[sample_no]);
+				if (skip_count)
+				{
+					sample_no += skip_count;
+					continue;
+				}
+			}
+
+			char const *values(data + (sample_no - 1) * ploidy * sizeof(t_int));
+			if (2 == ploidy)
+			{
+				auto const first(read_le <t_int>(values));
+				auto const second(read_le <t_int>(values + sizeof(t_int)));
+				if (vector_end != second)
+				{
+					m_current_variant.set_diploid_gt(allele_index(first), allele_index(second), sample_no, second & 0x1);
+					++sample_no;
+					continue;
+				}
+			}
+
+			for (std::size_t i(0); i < ploidy; ++i)
+			{
+				auto const value(read_le <t_int>(values + i * sizeof(t_int)));
+				if (vector_end == value)
+					break;
+
+				// Like in VCF, the first allele is not considered phased.
+				m_current_variant.set_gt(allele_index(value), sample_no, i, 0 != i && (value & 0x1));
+			}
+
+			++sample_no;
+		}
+	}
+}
@@ -0,0 +1,384 @@
+/*
+ Copyright (c) 2017 Tuukka Norri
+ This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <vcf2multialign/bgzf_reader.hh>
+#include <vcf2multialign/util.hh>
+#include <vcf2multialign/variant.hh>
+#include <zlib.h>
+
+
+namespace {
+
+	enum {
+		BGZF_HEADER_LENGTH		= 18,	// Including the BC subfield.
+		BGZF_FOOTER_LENGTH		= 8,
+		BGZF_MAX_BLOCK_SIZE		= 65536,
+		GZIP_FIXED_HEADER_LENGTH	= 12
+	};
+
+
+	inline std::uint16_t read_le_16(char const *data)
+	{
+		auto const *d(reinterpret_cast <unsigned char const *>(data));
+		return d[0] | (d[1] << 8);
+	}
+
+
+	inline std::uint32_t read_le_32(char const *data)
+	{
+		auto const *d(reinterpret_cast <unsigned char const *>(data));
+		return d[0] | (d[1] << 8) | (d[2] << 16) | (std::uint32_t(d[3]) << 24);
+	}
+
+
+	bool is_gzip_header(char const *data, std::size_t const len)
+	{
+		return (2 <= len && '\x1f' == data[0] && '\x8b' == data[1]);
+	}
+
+
+	// Store the total size of the block that starts from data to block_size or zero if the header is incomplete.
+	// Return false if the header is not a BGZF header.
+	bool bgzf_block_size(char const *data, std::size_t const len, std::size_t &block_size)
+	{
+		block_size = 0;
+		if (len < GZIP_FIXED_HEADER_LENGTH)
+			return true;
+
+		// Check the magic number, the compression method and FEXTRA.
+		if (! (is_gzip_header(data, len) && 8 == data[2] && (data[3] & 0x4)))
+			return false;
+
+		std::size_t const xlen(read_le_16(data + 10));
+		if (len < GZIP_FIXED_HEADER_LENGTH + xlen)
+			return true;
+
+		// Find the BC subfield.
+		char const *subfield(data + GZIP_FIXED_HEADER_LENGTH);
+		char const *extra_end(subfield + xlen);
+		while (subfield + 4 <= extra_end)
+		{
+			auto const slen(read_le_16(subfield + 2));
+			if ('B' == subfield[0] && 'C' == subfield[1] && 2 == slen && subfield + 6 <= extra_end)
+			{
+				block_size = 1 + read_le_16(subfield + 4);
+				return true;
+			}
+
+			subfield += 4 + slen;
+		}
+
+		return false;
+	}
+}
+
+
+namespace vcf2multialign {
+
+	compression_type detect_compression(int const fd)
+	{
+		char header[BGZF_HEADER_LENGTH];
+		auto const res(pread(fd, header, BGZF_HEADER_LENGTH, 0));
+		if (res <= 0 || !is_gzip_header(header, res))
+			return compression_type::NONE;
+
+		std::size_t block_size(0);
+		if (bgzf_block_size(header, res, block_size) && block_size)
+			return compression_type::BGZF;
+
+		return compression_type::GZIP;
+	}
+
+
+	bgzf_reader::bgzf_reader(std::size_t const batch_size):
+		m_prefetch_group(dispatch_group_create()),
+		m_batch_size(std::max <std::size_t>(batch_size, BGZF_MAX_BLOCK_SIZE))
+	{
+	}
+
+
+	bgzf_reader::~bgzf_reader()
+	{
+		wait_for_prefetch();
+		if (-1 != m_fd)
+			close(m_fd);
+	}
+
+
+	void bgzf_reader::open(int const fd)
+	{
+		wait_for_prefetch();
+		if (-1 != m_fd)
+			close(m_fd);
+
+		m_fd = fd;
+		m_current.clear();
+		m_current.next_coffset = 0;
+		m_block_idx = 0;
+		m_block_pos = 0;
+	}
+
+
+	void bgzf_reader::load_batch(batch &dst, std::uint64_t const coffset) const
+	{
+		dst.clear();
+		dst.coffset = coffset;
+		dst.compressed.resize(m_batch_size);
+
+		// Read the compressed data.
+		std::size_t len(0);
+		bool at_eof(false);
+		while (len < m_batch_size)
+		{
+			auto const res(pread(m_fd, dst.compressed.data() + len, m_batch_size - len, coffset + len));
+			if (-1 == res)
+			{
+				if (EINTR == errno)
+					continue;
+
+				auto const msg(boost::str(boost::format("Unable to read the BGZF file: %s") % strerror(errno)));
+				fail(msg.c_str());
+			}
+
+			if (0 == res)
+			{
+				at_eof = true;
+				break;
+			}
+
+			len += res;
+		}
+
+		// Find the complete blocks.
+		std::size_t pos(0);
+		while (pos < len)
+		{
+			std::size_t block_size(0);
+			always_assert(bgzf_block_size(dst.compressed.data() + pos, len - pos, block_size), "Invalid BGZF block header");
+			if (0 == block_size || len - pos < block_size)
+			{
+				always_assert(!at_eof, "Truncated BGZF file");
+				break;
+			}
+
+			if (dst.blocks.size() == dst.block_count)
+				dst.blocks.emplace_back();
+
+			auto &block(dst.blocks[dst.block_count++]);
+			block.coffset = coffset + pos;
+			block.batch_offset = pos;
+			block.compressed_size = block_size;
+			pos += block_size;
+		}
+
+		dst.next_coffset = coffset + pos;
+		dst.is_last = (at_eof && pos == len);
+
+		// Decompress the blocks in parallel.
+		auto queue(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+		dispatch_apply_f(dst.block_count, queue, &dst, &decompress_block);
+	}
+
+
+	void bgzf_reader::decompress_block(void *ctx, std::size_t const idx)
+	{
+		auto &src(*static_cast <batch *>(ctx));
+		auto &block(src.blocks[idx]);
+		char const *data(src.compressed.data() + block.batch_offset);
+		char const *footer(data + block.compressed_size - BGZF_FOOTER_LENGTH);
+
+		std::size_t const xlen(read_le_16(data + 10));
+		std::size_t const header_len(GZIP_FIXED_HEADER_LENGTH + xlen);
+		always_assert(header_len + BGZF_FOOTER_LENGTH <= block.compressed_size, "Invalid BGZF block size");
+
+		auto const expected_crc(read_le_32(footer));
+		auto const isize(read_le_32(footer + 4));
+		always_assert(isize <= BGZF_MAX_BLOCK_SIZE, "Invalid BGZF block size");
+		block.data.resize(isize);
+
+		if (isize)
+		{
+			z_stream stream{};
+			stream.next_in = reinterpret_cast <Bytef *>(const_cast <char *>(data + header_len));
+			stream.avail_in = block.compressed_size - header_len - BGZF_FOOTER_LENGTH;
+			stream.next_out = reinterpret_cast <Bytef *>(block.data.data());
+			stream.avail_out = isize;
+
+			// Raw deflate.
+			always_assert(Z_OK == inflateInit2(&stream, -15), "Unable to initialize zlib");
+			auto const res(inflate(&stream, Z_FINISH));
+			inflateEnd(&stream);
+			always_assert(Z_STREAM_END == res && 0 == stream.avail_out, "Unable to decompress a BGZF block");
+		}
+
+		auto const crc(crc32(crc32(0, nullptr, 0), reinterpret_cast <Bytef const *>(block.data.data()), isize));
+		always_assert(crc == expected_crc, "CRC mismatch in BGZF block");
+	}
+
+
+	void bgzf_reader::prefetch(void *ctx)
+	{
+		auto &reader(*static_cast <bgzf_reader *>(ctx));
+		reader.load_batch(reader.m_next, reader.m_current.next_coffset);
+	}
+
+
+	void bgzf_reader::start_prefetch()
+	{
+		if (m_current.is_last)
+			return;
+
+		m_is_prefetching = true;
+		auto queue(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+		dispatch_group_async_f(*m_prefetch_group, queue, this, &prefetch);
+	}
+
+
+	void bgzf_reader::wait_for_prefetch()
+	{
+		if (m_is_prefetching)
+		{
+			dispatch_group_wait(*m_prefetch_group, DISPATCH_TIME_FOREVER);
+			m_is_prefetching = false;
+		}
+	}
+
+
+	// Make m_block_idx and m_block_pos point to the next character. Return false on EOF.
+	bool bgzf_reader::ensure_data()
+	{
+		while (true)
+		{
+			if (m_block_idx < m_current.block_count)
+			{
+				if (m_block_pos < m_current.blocks[m_block_idx].data.size())
+					return true;
+
+				++m_block_idx;
+				m_block_pos = 0;
+				continue;
+			}
+
+			if (m_current.is_last)
+				return false;
+
+			// Continue with the next batch. The following one is decompressed while the current one is being consumed.
+			if (m_is_prefetching)
+			{
+				wait_for_prefetch();
+				using std::swap;
+				swap(m_current, m_next);
+			}
+			else
+			{
+				load_batch(m_current, m_current.next_coffset);
+			}
+
+			m_block_idx = 0;
+			m_block_pos = 0;
+			start_prefetch();
+		}
+	}
+
+
+	std::size_t bgzf_reader::read(char *dst, std::size_t const len, bool &at_eof)
+	{
+		std::size_t retval(0);
+		at_eof = false;
+		while (retval < len)
+		{
+			if (!ensure_data())
+			{
+				at_eof = true;
+				break;
+			}
+
+			auto const &block(m_current.blocks[m_block_idx]);
+			auto const count(std::min(len - retval, block.data.size() - m_block_pos));
+			char const *src(block.data.data() + m_block_pos);
+			std::copy(src, src + count, dst + retval);
+			m_block_pos += count;
+			retval += count;
+		}
+
+		return retval;
+	}
+
+
+	bool bgzf_reader::getline(std::string &dst)
+	{
+		dst.clear();
+		while (ensure_data())
+		{
+			auto const &block(m_current.blocks[m_block_idx]);
+			std::string_view sv(block.data.data() + m_block_pos, block.data.size() - m_block_pos);
+			auto const nl_pos(sv.find('\n'));
+			if (std::string_view::npos != nl_pos)
+			{
+				dst.append(sv.data(), nl_pos);
+				m_block_pos += 1 + nl_pos;
+				return true;
+			}
+
+			dst.append(sv.data(), sv.size());
+			m_block_pos = block.data.size();
+		}
+
+		return !dst.empty();
+	}
+
+
+	auto bgzf_reader::tell() const -> virtual_offset_type
+	{
+		// Find the block that contains the next character.
+		for (auto i(m_block_idx); i < m_current.block_count; ++i)
+		{
+			auto const &block(m_current.blocks[i]);
+			auto const pos(i == m_block_idx ? m_block_pos : 0);
+			if (pos < block.data.size())
+				return (block.coffset << 16) | pos;
+		}
+
+		return (m_current.next_coffset << 16);
+	}
+
+
+	void bgzf_reader::seek(virtual_offset_type const offset)
+	{
+		std::uint64_t const coffset(offset >> 16);
+		std::size_t const uoffset(offset & 0xffff);
+
+		// Check if the block has already been decompressed.
+		auto const begin(m_current.blocks.cbegin());
+		auto const end(begin + m_current.block_count);
+		auto const it(std::lower_bound(begin, end, coffset, [](block const &block, std::uint64_t const val) {
+			return block.coffset < val;
+		}));
+
+		if (end != it && it->coffset == coffset)
+		{
+			m_block_idx = it - begin;
+			m_block_pos = uoffset;
+			always_assert(m_block_pos <= it->data.size(), "Invalid virtual offset");
+			return;
+		}
+
+		// Discard the decompressed data.
+		wait_for_prefetch();
+		load_batch(m_current, coffset);
+		m_block_idx = 0;
+		m_block_pos = uoffset;
+		always_assert(
+			(0 == uoffset) || (m_current.block_count && uoffset <= m_current.blocks[0].data.size()),
+			"Invalid virtual offset"
+		);
+		start_prefetch();
+	}
+}
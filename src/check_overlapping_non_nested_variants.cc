@@ -7,6 +7,7 @@
 #include <boost/bimap/list_of.hpp>
 #include <boost/bimap/multiset_of.hpp>
 #include <boost/range/adaptor/reversed.hpp>
+#include <boost/range/combine.hpp>
 #include <iostream>
 #include <vcf2multialign/check_overlapping_non_nested_variants.hh>
 #include <vcf2multialign/util.hh>
@@ -123,6 +124,95 @@ namespace {
 
 		return false;
 	}
+	
+	
+	bool check_alt_seq(std::string_view const &alt)
+	{
+		for (auto const c : alt)
+		{
+			if (! ('A' == c || 'C' == c || 'G' == c || 'T' == c || 'N' == c))
+				return false;
+		}
+		
+		return true;
+	}
+	
+	
+	// Check that the ALT sequences are something that can be handled.
+	void fill_valid_alts(
+		v2m::transient_variant const &var,
+		v2m::sv_handling const sv_handling_method,
+		v2m::error_logger &error_logger,
+		v2m::alt_bitmask /* out */ &valid_alts
+	)
+	{
+		valid_alts.clear();
+		
+		std::size_t i(0);
+		auto const lineno(var.lineno());
+		
+		if (v2m::sv_handling::DISCARD == sv_handling_method)
+		{
+			for (auto const &ref : boost::combine(var.alts(), var.alt_sv_types()))
+			{
+				++i;
+				
+				auto const alt_svt(ref.get <1>());
+				if (v2m::sv_type::NONE != alt_svt)
+					continue;
+				
+				auto const &alt(ref.get <0>());
+				if (!check_alt_seq(alt))
+				{
+					error_logger.log_invalid_alt_seq(lineno, i, alt);
+					continue;
+				}
+				
+				valid_alts.insert(i);
+			}
+		}
+		else
+		{
+			for (auto const &ref : boost::combine(var.alts(), var.alt_sv_types()))
+			{
+				++i;
+				
+				auto const alt_svt(ref.get <1>());
+				switch (alt_svt)
+				{
+					case v2m::sv_type::NONE:
+					{
+						auto const &alt(ref.get <0>());
+						if (check_alt_seq(alt))
+							valid_alts.insert(i);
+						else
+							error_logger.log_invalid_alt_seq(lineno, i, alt);
+						
+						break;
+					}
+					
+					case v2m::sv_type::DEL:
+					case v2m::sv_type::DEL_ME:
+						valid_alts.insert(i);
+						break;
+					
+					case v2m::sv_type::INS:
+					case v2m::sv_type::DUP:
+					case v2m::sv_type::INV:
+					case v2m::sv_type::CNV:
+					case v2m::sv_type::DUP_TANDEM:
+					case v2m::sv_type::INS_ME:
+					case v2m::sv_type::UNKNOWN:
+						error_logger.log_skipped_structural_variant(lineno, i, alt_svt);
+						break;
+					
+					default:
+						v2m::fail("Unexpected structural variant type.");
+						break;
+				}
+			}
+		}
+	}
 }
 
 
@@ -132,6 +222,7 @@ namespace vcf2multialign {
 		vcf_reader &reader,
 		sv_handling const sv_handling_method,
 		variant_set /* out */ &skipped_variants,
+		valid_alt_map /* out */ &valid_alts,
 		error_logger &error_logger
 	)
 	{
@@ -146,6 +237,7 @@ namespace vcf2multialign {
 		overlap_map bad_overlaps;
 		size_t i(0);
 		size_t conflict_count(0);
+		alt_bitmask var_valid_alts;
 		
 		reader.reset();
 		reader.set_parsed_fields(vcf_field::ALT);
@@ -155,6 +247,8 @@ namespace vcf2multialign {
 			should_continue = reader.parse(
 				[
 					&skipped_variants,
+					&valid_alts,
+					&var_valid_alts,
 					&error_logger,
 					&last_position,
 					&end_positions,
@@ -170,7 +264,7 @@ namespace vcf2multialign {
 				// Verify that the positions are in increasing order.
 				auto const pos(var.zero_based_pos());
 
-				always_assert(last_position <= pos, "Positions not in increasing order");
+				always_assert(last_position <= pos, "Positions not in increasing order; please sort the variants, e.g. with --sort");
 				
 				auto const var_ref(var.ref());
 				auto const var_ref_size(var_ref.size());
@@ -184,6 +278,10 @@ namespace vcf2multialign {
 					error_logger.log_no_supported_alts(var_lineno);
 					goto loop_end_2;
 				}
+				
+				// Store the ALTs that can be handled so that the handler need not check them again.
+				fill_valid_alts(var, sv_handling_method, error_logger, var_valid_alts);
+				valid_alts.add(var_lineno, var.alts().size(), var_valid_alts);
 
 				{
 					// Try to find an end position that is greater than var's position.
@@ -120,7 +120,7 @@ namespace vcf2multialign {
 	}
 	
 	
-	void error_logger::log_invalid_alt_seq(std::size_t const line, std::size_t const alt_idx, std::string const &alt)
+	void error_logger::log_invalid_alt_seq(std::size_t const line, std::size_t const alt_idx, std::string_view const &alt)
 	{
 		if (is_logging_errors())
 		{
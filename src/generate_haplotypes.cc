@@ -5,28 +5,44 @@
 
 #include <boost/format.hpp>
 #include <boost/io/ios_state.hpp>
+#include <boost/optional.hpp>
 #include <boost/range/combine.hpp>
+#include <algorithm>
 #include <cerrno>
 #include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <fcntl.h>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vcf2multialign/bcf_reader.hh>
 #include <vcf2multialign/check_overlapping_non_nested_variants.hh>
 #include <vcf2multialign/dispatch_fn.hh>
 #include <vcf2multialign/generate_haplotypes.hh>
 #include <vcf2multialign/read_single_fasta_seq.hh>
 #include <vcf2multialign/sample_reducer.hh>
 #include <vcf2multialign/sequence_writer.hh>
+#include <vcf2multialign/tabix_index.hh>
 #include <vcf2multialign/types.hh>
 #include <vcf2multialign/variant_handler.hh>
+#include <vcf2multialign/vcf_line_index.hh>
+#include <vcf2multialign/vcf_merging_reader.hh>
+#include <vcf2multialign/vcf_sorter.hh>
+#include <vcf2multialign/vcf_spool_reader.hh>
 
 namespace ios	= boost::iostreams;
 namespace v2m	= vcf2multialign;
 
 
 namespace {
+	class pipeline_runner;
 	class generate_context;
 	class genotype_handling_delegate;
 	class all_genotypes_handling_delegate;
@@ -34,6 +50,13 @@ namespace {
 	
 	void handle_file_error(char const *fname);
 	void open_file_for_reading(char const *fname, v2m::file_istream &stream);
+	bool open_vcf_input(
+		char const *fname,
+		v2m::file_istream &stream,
+		std::unique_ptr <v2m::vcf_input> &input,
+		std::unique_ptr <v2m::vcf_reader> &reader,
+		bool const should_spool
+	);
 	void open_file_for_writing(char const *fname, v2m::file_ostream &stream, bool const should_overwrite);
 	bool compare_references(v2m::vector_type const &ref, std::string_view const &var_ref, std::size_t const var_pos, std::size_t /* out */ &idx);
 	
@@ -50,17 +73,89 @@ namespace {
 	);
 		
 		
+	// Start the pipelines of the variant and reference file pairs so that
+	// at most a given number of them is running at a time and their estimated
+	// memory usage does not exceed the memory limit. Since the number of
+	// output files depends on the ploidy, each pipeline also reserves file descriptors
+	// for them before the first round and waits if the open file limit would be exceeded.
+	class pipeline_runner
+	{
+	public:
+		typedef std::function <void(pipeline_runner &, std::size_t)> start_fn;
+		typedef std::function <void()> reservation_fn;
+		
+		// Descriptors used by a pipeline in addition to its output files, e.g. the input files.
+		// The sorter's temporary files are counted separately.
+		enum { FIXED_DESCRIPTOR_COUNT = 8 };
+		
+	protected:
+		struct descriptor_request
+		{
+			std::size_t		count{0};
+			reservation_fn	fn;
+			
+			descriptor_request(std::size_t const count_, reservation_fn &&fn_):
+				count(count_),
+				fn(std::move(fn_))
+			{
+			}
+		};
+		
+	protected:
+		start_fn							m_start_fn;
+		std::mutex							m_mutex;
+		std::deque <descriptor_request>		m_descriptor_requests;
+		std::size_t							m_pipeline_count{0};
+		std::size_t							m_next_pipeline{0};
+		std::size_t							m_finished_count{0};
+		std::size_t							m_descriptor_limit{SIZE_MAX};
+		std::size_t							m_fixed_descriptor_count{FIXED_DESCRIPTOR_COUNT};
+		std::vector <std::size_t>			m_memory_usage;					// Estimate for each pipeline.
+		std::size_t							m_memory_limit{SIZE_MAX};
+		std::size_t							m_reserved_memory{0};
+		std::size_t							m_running_count{0};
+		std::size_t							m_max_running_count{0};
+		std::size_t							m_reserved_descriptors{0};
+		std::size_t							m_output_reservation_count{0};	// Number of pipelines that have reserved descriptors for output.
+		
+	protected:
+		bool next_pipeline(std::size_t &idx);
+		bool can_reserve_descriptors(std::size_t const count) const;
+		
+	public:
+		pipeline_runner(std::size_t const pipeline_count, start_fn &&fn):
+			m_start_fn(std::move(fn)),
+			m_pipeline_count(pipeline_count)
+		{
+		}
+		
+		void set_descriptor_limit(std::size_t const limit) { m_descriptor_limit = limit; }
+		void set_fixed_descriptor_count(std::size_t const count) { m_fixed_descriptor_count = count; }
+		void set_memory_limit(std::size_t const limit, std::vector <std::size_t> &&memory_usage) { m_memory_limit = limit; m_memory_usage = std::move(memory_usage); }
+		void start(std::size_t const max_running_count);
+		
+		// Call fn when count descriptors may be used for output files, possibly from another thread.
+		void reserve_output_descriptors(std::size_t const count, reservation_fn &&fn);
+		
+		// Called by each pipeline when done. Exits after the last one.
+		void pipeline_did_finish(std::size_t const idx, std::size_t const output_descriptor_count);
+	};
+	
+	
 	class generate_context
 	{
 	protected:
 		typedef std::map <std::size_t, std::size_t> ploidy_map;
 	
 	protected:
+		std::unique_ptr <v2m::vcf_reader>					m_vcf_reader{new v2m::vcf_reader};	// Replaced when the variant file is opened.
 		v2m::variant_handler								m_variant_handler;
 	
 		v2m::vector_type									m_reference;
 		v2m::file_istream									m_vcf_stream;
-		v2m::vcf_reader										m_vcf_reader;
+		std::unique_ptr <v2m::vcf_input>					m_vcf_input{};
+		std::vector <std::unique_ptr <v2m::file_istream>>	m_partition_streams;		// Of the sample-partitioned variant files.
+		std::vector <std::unique_ptr <v2m::vcf_input>>		m_partition_inputs;
 	
 		std::unique_ptr <v2m::variant_handler_delegate>		m_variant_handler_delegate{};
 		std::unique_ptr <genotype_handling_delegate>		m_genotype_delegate{};
@@ -73,14 +168,29 @@ namespace {
 		ploidy_map											m_ploidy;
 		v2m::haplotype_map									m_haplotypes;
 		v2m::variant_set									m_skipped_variants;
+		v2m::valid_alt_map									m_valid_alts;
+		v2m::vcf_region										m_region;
+		v2m::vcf_line_index									m_line_index;
+		std::vector <std::size_t>							m_original_line_numbers;	// Of the sorted records.
 	
 		boost::optional <std::string>						m_out_reference_fname;
 		std::string											m_null_allele_seq;
+		std::string											m_output_prefix;			// Distinguishes the output files of the pipelines.
+		pipeline_runner										*m_pipeline_runner{nullptr};
+		std::size_t											m_pipeline_idx{0};
 		v2m::sv_handling									m_sv_handling_method;
 		std::size_t											m_chunk_size{0};
+		std::size_t											m_output_descriptor_count{0};	// Reserved from the pipeline runner.
+		std::size_t											m_parser_thread_count{0};
+		std::size_t											m_split_line_length{0};
+		std::size_t											m_input_buffer_size{0};
+		std::size_t											m_read_ahead_buffer_count{0};
+		std::size_t											m_sort_buffer_size{0};		// Zero if the records are not sorted.
 		std::size_t											m_current_round{0};
 		std::size_t											m_total_rounds{0};
 		bool												m_should_overwrite_files{false};
+		bool												m_has_line_index{false};
+		bool												m_vcf_is_temporary{false};	// Is the variant file read from a temporary file or a pipe.
 	
 	public:
 		generate_context(
@@ -88,8 +198,14 @@ namespace {
 			v2m::dispatch_ptr <dispatch_queue_t> &&parsing_queue,
 			char const *out_reference_fname,
 			char const *null_allele_seq,
+			char const *region,
 			v2m::sv_handling const sv_handling_method,
 			std::size_t const chunk_size,
+			std::size_t const parser_thread_count,
+			std::size_t const split_line_length,
+			std::size_t const input_buffer_size,
+			std::size_t const read_ahead_buffer_count,
+			std::size_t const sort_buffer_size,
 			std::size_t const variant_padding,
 			bool const should_overwrite_files,
 			bool const should_reduce_samples,
@@ -98,19 +214,26 @@ namespace {
 			m_variant_handler(
 				std::move(main_queue),
 				std::move(parsing_queue),
-				m_vcf_reader,
+				*m_vcf_reader,
 				m_reference,
 				sv_handling_method,
 				m_skipped_variants,
+				m_valid_alts,
 				m_error_logger
 			),
 			m_null_allele_seq(null_allele_seq),
 			m_sv_handling_method(sv_handling_method),
 			m_chunk_size(chunk_size),
+			m_parser_thread_count(parser_thread_count),
+			m_split_line_length(split_line_length),
+			m_input_buffer_size(input_buffer_size),
+			m_read_ahead_buffer_count(read_ahead_buffer_count),
+			m_sort_buffer_size(sort_buffer_size),
 			m_should_overwrite_files(should_overwrite_files)
 		{
 			finish_init(
 				out_reference_fname,
+				region,
 				should_reduce_samples,
 				variant_padding,
 				allow_switch_to_ref
@@ -120,7 +243,7 @@ namespace {
 		generate_context(generate_context const &) = delete;
 		generate_context(generate_context &&) = delete;
 	
-		v2m::vcf_reader &vcf_reader()						{ return m_vcf_reader; }
+		v2m::vcf_reader &vcf_reader()						{ return *m_vcf_reader; }
 		v2m::error_logger &error_logger()					{ return m_error_logger; }
 		v2m::variant_handler &variant_handler()				{ return m_variant_handler; }
 		v2m::haplotype_map &haplotypes()					{ return m_haplotypes; }
@@ -133,18 +256,23 @@ namespace {
 		std::string const &out_reference_fname() const		{ return m_out_reference_fname.value(); }
 		std::string const &null_allele_seq() const			{ return m_null_allele_seq; }
 		v2m::vector_type const &reference() const			{ return m_reference; }
+		v2m::vcf_region const &region() const				{ return m_region; }
 		bool should_overwrite_files() const					{ return m_should_overwrite_files; }
 		bool has_out_reference_fname() const				{ return m_out_reference_fname.operator bool(); }
 		
 		void set_variant_handler_delegate(std::unique_ptr <v2m::variant_handler_delegate> &&delegate);
+		void set_pipeline_runner(pipeline_runner &runner, std::size_t const idx, std::string const &output_prefix) { m_pipeline_runner = &runner; m_pipeline_idx = idx; m_output_prefix = output_prefix; }
+		std::string output_fname(std::string const &fname) const;
 		
 		void cleanup() { delete this; }
 		void load_and_generate(
 			char const *reference_fname,
-			char const *variants_fname,
+			std::vector <std::string> const &variants_fnames,
 			char const *report_fname,
-			bool const should_check_ref
+			bool const should_check_ref,
+			bool const should_use_line_index
 		);
+		void check_and_generate(bool const should_check_ref);
 			
 		void prepare_sample_names_and_generate_sequences();
 		void generate_sequences(bool const output_reference = false);
@@ -154,10 +282,15 @@ namespace {
 	protected:
 		void finish_init(
 			char const *out_reference_fname,
+			char const *region,
 			bool const should_reduce_samples,
 			std::size_t const variant_padding,
 			bool const allow_switch_to_ref
 		);
+		void open_vcf_partitions(std::vector <std::string> const &variants_fnames);
+		void sort_variants();
+		void load_line_index(char const *variants_fname);
+		void prepare_region(char const *variants_fname);
 		void check_ploidy();
 		void check_ref();
 	};
@@ -231,24 +364,26 @@ namespace {
 	};
 	
 	
+	// The variant processing delegate methods are not virtual; sequence_writer and sample_reducer
+	// are instantiated with the concrete delegate types, which lets the compiler inline the calls.
 	template <bool t_logging>
-	class vh_stats : public virtual v2m::variant_processor_delegate
+	class vh_stats
 	{
 	public:
-		virtual void assigned_alt_to_sequence(std::size_t const alt_idx) override {}
-		virtual void found_overlapping_alt(
+		void assigned_alt_to_sequence(std::size_t const alt_idx) {}
+		void found_overlapping_alt(
 			std::size_t const lineno,
 			uint8_t const alt_idx,
 			std::size_t const sample_no,
 			uint8_t const chr_idx
-		) override {}
-		virtual void handled_alt(std::size_t const alt_idx) override {}
-		virtual void handled_haplotypes(v2m::variant &var) override {}
+		) {}
+		void handled_alt(std::size_t const alt_idx) {}
+		void handled_haplotypes(v2m::variant &var) {}
 	};
 	
 	
 	template <>
-	class vh_stats <true> : public virtual v2m::variant_processor_delegate, public virtual vh_generate_context_helper
+	class vh_stats <true> : public virtual vh_generate_context_helper
 	{
 	protected:
 		v2m::variant_set						m_overlapping_alts{};
@@ -257,46 +392,48 @@ namespace {
 		v2m::sample_count						m_non_ref_totals;		// In current variant.
 		
 	public:
-		virtual void assigned_alt_to_sequence(std::size_t const alt_idx) override;
-		virtual void found_overlapping_alt(
+		inline void assigned_alt_to_sequence(std::size_t const alt_idx);
+		void found_overlapping_alt(
 			std::size_t const lineno,
 			uint8_t const alt_idx,
 			std::size_t const sample_no,
 			uint8_t const chr_idx
-		) override;
-		virtual void handled_alt(std::size_t const alt_idx) override;
-		virtual void handled_haplotypes(v2m::variant &var) override;
+		);
+		inline void handled_alt(std::size_t const alt_idx);
+		void handled_haplotypes(v2m::variant &var);
 
 		void handle_variant(v2m::variant &var);
 	};
 	
 	
+	template <typename t_delegate>
 	class vh_sequence_writer :
 		public virtual vh_generate_context_helper,
 		public virtual v2m::variant_handler_delegate
 	{
 	protected:
-		v2m::sequence_writer		m_sequence_writer;
+		v2m::sequence_writer <t_delegate>	m_sequence_writer;
 		
 	public:
 		virtual ~vh_sequence_writer() {}
 		vh_sequence_writer(
-			v2m::sequence_writer_delegate &delegate,
+			t_delegate &delegate,
 			v2m::vector_type const &reference,
-			std::string const &null_allele
+			std::string const &null_allele,
+			v2m::vcf_region const &region
 		):
 			m_sequence_writer(reference, null_allele)
 		{
 			m_sequence_writer.set_delegate(delegate);
+			if (region.is_set())
+				m_sequence_writer.set_output_range(region.first_pos - 1, region.last_pos);
 		}
 		
-		virtual void finish();
+		virtual void finish() override;
 	};
 	
 	
 	class vh_delegate :
-		public v2m::sample_reducer_delegate,
-		public v2m::sequence_writer_delegate,
 		public virtual v2m::variant_handler_delegate,
 		public virtual vh_generate_context_helper
 	{
@@ -314,22 +451,18 @@ namespace {
 		virtual class generate_context &generate_context() override { return *m_ctx; }
 		virtual class generate_context const &generate_context() const override { return *m_ctx; }
 		
-		virtual v2m::vcf_reader::sample_name_map const &sample_names() const override;
-		virtual bool is_valid_alt(std::size_t const alt_idx) const override;
-		virtual std::set <std::size_t> const &valid_alts(v2m::variant &var) const override;
+		bool is_valid_alt(std::size_t const alt_idx) const { return m_ctx->variant_handler().is_valid_alt(alt_idx); }
+		v2m::alt_bitmask const &valid_alts(v2m::variant &var) const { return m_ctx->variant_handler().valid_alts(); }
 		
-		virtual void enumerate_genotype(
-			v2m::variant &var,
-			std::size_t const sample_no,
-			std::function <void(uint8_t, std::size_t, bool)> const &cb
-		) override;
+		template <typename t_cb>
+		void enumerate_carriers(v2m::variant &var, t_cb &&cb) { m_ctx->variant_handler().enumerate_carriers(var, cb); }
 	};
 	
 	
 	class compress_vh_delegate : public vh_stats <true>, public vh_delegate
 	{
 	protected:
-		v2m::sample_reducer		m_sample_reducer;
+		v2m::sample_reducer <compress_vh_delegate>	m_sample_reducer;
 		
 	public:
 		compress_vh_delegate(
@@ -351,7 +484,10 @@ namespace {
 	};
 	
 	
-	class read_compressed_vh_delegate : public vh_stats <false>, public vh_sequence_writer, public vh_delegate
+	class read_compressed_vh_delegate :
+		public vh_stats <false>,
+		public vh_sequence_writer <read_compressed_vh_delegate>,
+		public vh_delegate
 	{
 	protected:
 		typedef v2m::range_map::value_type::const_iterator		variant_range_iterator;
@@ -360,37 +496,38 @@ namespace {
 	protected:
 		v2m::range_map					*m_compressed_ranges{};
 		std::vector <range_el_iterator>	m_iterators;
-		std::set <std::size_t>			m_valid_alts;
+		v2m::alt_bitmask				m_valid_alts;
 		
 	public:
 		read_compressed_vh_delegate(class generate_context &ctx, v2m::range_map &compressed_ranges):
-			vh_sequence_writer(*this, ctx.reference(), ctx.null_allele_seq()),
+			vh_sequence_writer(*this, ctx.reference(), ctx.null_allele_seq(), ctx.region()),
 			vh_delegate(ctx),
 			m_compressed_ranges(&compressed_ranges),
 			m_iterators(m_compressed_ranges->size())
 		{
 		}
 		
-		virtual bool is_valid_alt(std::size_t const alt_idx) const override { return true; }
-		virtual std::set <std::size_t> const &valid_alts(v2m::variant &var) const override { return m_valid_alts; }
+		bool is_valid_alt(std::size_t const alt_idx) const { return true; }
+		v2m::alt_bitmask const &valid_alts(v2m::variant &var) const { return m_valid_alts; }
 		virtual void prepare(v2m::vcf_reader &reader) override;
 		virtual void handle_variant(v2m::variant &var) override;
-		void enumerate_genotype(
-			v2m::variant &var,
-			std::size_t const sample_no,
-			std::function <void(uint8_t, std::size_t, bool)> const &cb
-		) override;
+		
+		template <typename t_cb>
+		void enumerate_carriers(v2m::variant &var, t_cb &&cb);
 			
 	protected:
 		bool update_iterator_position(v2m::variant const &var, range_el_iterator &it);
 	};
 	
 	
-	class all_genotypes_vh_delegate : public vh_stats <true>, public vh_sequence_writer, public vh_delegate
+	class all_genotypes_vh_delegate :
+		public vh_stats <true>,
+		public vh_sequence_writer <all_genotypes_vh_delegate>,
+		public vh_delegate
 	{
 	public:
 		all_genotypes_vh_delegate(class generate_context &ctx):
-			vh_sequence_writer(*this, ctx.reference(), ctx.null_allele_seq()),
+			vh_sequence_writer(*this, ctx.reference(), ctx.null_allele_seq(), ctx.region()),
 			vh_delegate(ctx)
 		{
 		}
@@ -420,6 +557,138 @@ namespace {
 	}
 	
 	
+	// Copy the contents of e.g. a pipe as is to an unlinked temporary file so that
+	// the passes may read it again. Return the descriptor of the file.
+	int copy_to_temporary_file(std::istream &stream, char const *fname)
+	{
+		int const tmp_fd(v2m::open_temporary_file());
+		if (-1 == tmp_fd)
+			handle_file_error("temporary file");
+		
+		std::vector <char> buffer(1024 * 1024);
+		while (stream)
+		{
+			stream.read(buffer.data(), buffer.size());
+			if (stream.bad())
+			{
+				std::cerr << "Got an error while reading '" << fname << "'." << std::endl;
+				exit(EXIT_FAILURE);
+			}
+			
+			if (!v2m::write_all(tmp_fd, buffer.data(), stream.gcount()))
+			{
+				std::cerr << "Got an error while writing to a temporary file: " << strerror(errno) << std::endl;
+				exit(EXIT_FAILURE);
+			}
+		}
+		
+		return tmp_fd;
+	}
+	
+	
+	// Create a reader for either VCF or BCF depending on the file contents.
+	// Return true if the variant file is not a regular file.
+	bool open_vcf_input(
+		char const *fname,
+		v2m::file_istream &stream,
+		std::unique_ptr <v2m::vcf_input> &input,
+		std::unique_ptr <v2m::vcf_reader> &reader,
+		bool const should_spool
+	)
+	{
+		int fd(0 == strcmp(fname, "-") ? dup(STDIN_FILENO) : open(fname, O_RDONLY));
+		if (-1 == fd)
+			handle_file_error(fname);
+		
+		// Each pass reads the variant file from the beginning, and the readers use pread and mmap.
+		// Non-seekable input, e.g. from a pipe, is therefore read only once. Uncompressed records are
+		// spooled in a compact form as they are parsed unless the sorter reads them first.
+		// Compressed input is copied as is to a regular file, since its readers need random access.
+		bool is_copied(false);
+		{
+			struct stat sb;
+			if (0 != fstat(fd, &sb))
+				handle_file_error(fname);
+			
+			if (!S_ISREG(sb.st_mode))
+			{
+				ios::file_descriptor_source source(fd, ios::close_handle);
+				stream.open(source);
+				
+				// Both BGZF and BCF start with the gzip magic number.
+				if (0x1f != stream.peek())
+				{
+					stream.exceptions(std::istream::badbit);
+					input.reset(new v2m::vcf_stream_input(stream));
+					reader.reset(new v2m::vcf_reader(*input));
+					if (should_spool)
+					{
+						std::cerr << "The variant file is not a regular file; storing the records in a temporary file while reading them…" << std::endl;
+						std::unique_ptr <v2m::vcf_reader> spool_reader(new v2m::vcf_spool_reader(std::move(reader)));
+						reader = std::move(spool_reader);
+					}
+					return true;
+				}
+				
+				std::cerr << "The compressed variant file is not a regular file; copying it to a temporary file…" << std::endl;
+				fd = copy_to_temporary_file(stream, fname);
+				stream.close();
+				is_copied = true;
+			}
+		}
+		
+		// Decompress BGZF in parallel.
+		switch (v2m::detect_compression(fd))
+		{
+			case v2m::compression_type::BGZF:
+			{
+				// Decode BCF directly instead of requiring it to be converted to VCF.
+				if (v2m::is_bcf(fd))
+				{
+					std::unique_ptr <v2m::bcf_reader> bcf_reader(new v2m::bcf_reader);
+					bcf_reader->open(fd);
+					reader = std::move(bcf_reader);
+					return is_copied;
+				}
+				
+				std::unique_ptr <v2m::vcf_bgzf_input> bgzf_input(new v2m::vcf_bgzf_input);
+				bgzf_input->open(fd);
+				input = std::move(bgzf_input);
+				reader.reset(new v2m::vcf_reader(*input));
+				return is_copied;
+			}
+			
+			case v2m::compression_type::GZIP:
+				std::cerr << "The variant file '" << fname << "' is compressed with gzip but not with bgzip; only BGZF compression is supported." << std::endl;
+				exit(EXIT_FAILURE);
+			
+			case v2m::compression_type::NONE:
+			default:
+				break;
+		}
+		
+		// Map the file to memory if possible so that the parser may read it without copying.
+		{
+			std::unique_ptr <v2m::vcf_mmap_input> mmap_input(new v2m::vcf_mmap_input);
+			if (mmap_input->open(fd))
+			{
+				close(fd);
+				input = std::move(mmap_input);
+				reader.reset(new v2m::vcf_reader(*input));
+				return is_copied;
+			}
+		}
+		
+		// Fall back to reading with a stream, e.g. in case of an empty file.
+		ios::file_descriptor_source source(fd, ios::close_handle);
+		stream.open(source);
+		stream.exceptions(std::istream::badbit);
+		input.reset(new v2m::vcf_stream_input(stream));
+		reader.reset(new v2m::vcf_reader(*input));
+		return is_copied;
+	}
+	
+	
 	void open_file_for_writing(char const *fname, v2m::file_ostream &stream, bool const should_overwrite)
 	{
 		int fd(0);
@@ -494,6 +763,7 @@ namespace {
 	
 	void generate_context::finish_init(
 		char const *out_reference_fname,
+		char const *region,
 		bool const should_reduce_samples,
 		std::size_t const variant_padding,
 		bool const allow_switch_to_ref
@@ -502,6 +772,12 @@ namespace {
 		if (out_reference_fname)
 			m_out_reference_fname.emplace(out_reference_fname);
 		
+		if (region && !m_region.parse(region))
+		{
+			std::cerr << "Unable to parse the region '" << region << "'; expected chrom:first-last." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		
 		if (should_reduce_samples)
 			m_genotype_delegate.reset(new compressed_genotypes_handling_delegate(out_reference_fname != nullptr, variant_padding, allow_switch_to_ref));
 		else
@@ -512,64 +788,219 @@ namespace {
 	}
 	
 	
-	void generate_context::check_ploidy()
+	// Read the sample partitions of the variants in lock-step.
+	void generate_context::open_vcf_partitions(std::vector <std::string> const &variants_fnames)
 	{
-		size_t i(0);
-		m_vcf_reader.reset();
-		m_vcf_reader.set_parsed_fields(v2m::vcf_field::ALL);
-		
-		m_vcf_reader.fill_buffer();
-		if (!m_vcf_reader.parse([this](v2m::transient_variant const &var) -> bool {
-			for (auto const &kv : m_vcf_reader.sample_names())
+		std::unique_ptr <v2m::vcf_merging_reader> merging_reader(new v2m::vcf_merging_reader);
+		for (auto const &fname : variants_fnames)
+		{
+			auto &stream(m_partition_streams.emplace_back(new v2m::file_istream));
+			std::unique_ptr <v2m::vcf_input> input;
+			std::unique_ptr <v2m::vcf_reader> reader;
+			open_vcf_input(fname.c_str(), *stream, input, reader, true);
+			
+			if (input)
 			{
-				auto const sample_no(kv.second);
-				auto const &sample(var.sample(sample_no));
-				m_ploidy[sample_no] = sample.ploidy();
+				input->set_preferred_buffer_size(m_input_buffer_size);
+				input->set_read_ahead_buffer_count(m_read_ahead_buffer_count);
+				m_partition_inputs.emplace_back(std::move(input));
 			}
 			
-			return false;
-		}))
+			merging_reader->add_partition(std::move(reader));
+		}
+		
+		m_vcf_reader = std::move(merging_reader);
+	}
+	
+	
+	// Sort the records by position into a temporary file and parse it instead of the original input.
+	void generate_context::sort_variants()
+	{
+		if (!m_vcf_input)
+		{
+			std::cerr << "Sorting is only supported for a single uncompressed or bgzip-compressed VCF file; the variants are expected to be sorted." << std::endl;
+			return;
+		}
+		
+		std::cerr << "Sorting the variants…" << std::endl;
+		int const fd(v2m::open_temporary_file());
+		if (-1 == fd)
+			handle_file_error("temporary file");
+		
 		{
+			v2m::vcf_sorter sorter(m_sort_buffer_size);
+			sorter.sort(*m_vcf_input, m_vcf_reader->lineno(), fd, m_original_line_numbers);
+		}
+		
+		// Empty files cannot be mapped but neither do they need to be sorted.
+		std::unique_ptr <v2m::vcf_mmap_input> input(new v2m::vcf_mmap_input);
+		bool const is_mapped(input->open(fd));
+		close(fd);
+		if (!is_mapped)
+			return;
+		
+		// The errors are reported with the line numbers of the original file.
+		input->store_first_variant_offset();
+		m_vcf_input = std::move(input);
+		m_vcf_reader->set_input(*m_vcf_input);
+		m_vcf_reader->set_line_numbers(m_original_line_numbers);
+		m_vcf_is_temporary = true;
+	}
+	
+	
+	void generate_context::load_line_index(char const *variants_fname)
+	{
+		if (!m_partition_streams.empty())
+		{
+			std::cerr << "The line index is not used with sample-partitioned variant files." << std::endl;
+			return;
+		}
+		
+		// The index would not be stored next to the original input.
+		if (m_vcf_is_temporary)
+		{
+			std::cerr << "The variant file is not read from a regular file; not using a line index." << std::endl;
+			return;
+		}
+		
+		if (m_line_index.read(variants_fname))
+		{
+			m_has_line_index = true;
+			return;
+		}
+		
+		// Build the index from the records after the header. The passes start with reset().
+		std::cerr << "Building the line index…" << std::endl;
+		if (! (m_vcf_input && m_line_index.build(variants_fname, *m_vcf_input, m_vcf_reader->lineno())))
+		{
+			std::cerr << "The variant file does not support random access; not using a line index." << std::endl;
+			return;
+		}
+		
+		m_has_line_index = true;
+		if (!m_line_index.write(variants_fname))
+			std::cerr << "Unable to write the line index to '" << v2m::vcf_line_index::index_fname(variants_fname) << "'." << std::endl;
+	}
+	
+	
+	void generate_context::prepare_region(char const *variants_fname)
+	{
+		m_vcf_reader->set_region(m_region);
+		
+		if (!m_partition_streams.empty())
+		{
+			std::cerr << "Reading the whole sample-partitioned variant files to find the region." << std::endl;
+			return;
+		}
+		
+		// The line index retains the line numbers, so prefer it to tabix and CSI indices.
+		if (m_has_line_index)
+		{
+			v2m::vcf_line_index::entry entry;
+			if (! (m_line_index.find_region_start(m_region, entry) && m_vcf_reader->set_first_variant(entry.offset, entry.lineno)))
+				std::cerr << "The line index has no records on the given chromosome." << std::endl;
+			return;
+		}
+		
+		// Only BGZF compressed files may be indexed.
+		auto *bgzf_input(dynamic_cast <v2m::vcf_bgzf_input *>(m_vcf_input.get()));
+		auto *bcf_reader(dynamic_cast <v2m::bcf_reader *>(m_vcf_reader.get()));
+		if (! (bgzf_input || bcf_reader))
+		{
+			std::cerr << "The variant file is not compressed with bgzip; reading the whole file to find the region." << std::endl;
+			return;
+		}
+		
+		v2m::tabix_index index;
+		std::string const fname(variants_fname);
+		if (! ((bgzf_input && index.open((fname + ".tbi").c_str())) || index.open((fname + ".csi").c_str())))
+		{
+			std::cerr << "Found no tabix or CSI index; reading the whole file to find the region." << std::endl;
+			return;
+		}
+		
+		// CSI indices of BCF files refer to the sequences by their indices in the header.
+		v2m::tabix_index::virtual_offset_type offset(0);
+		std::size_t seq_idx(0);
+		if (! (bcf_reader
+			? (bcf_reader->contig_index(m_region.chrom_id, seq_idx) && index.find_first_offset(seq_idx, m_region.first_pos - 1, m_region.last_pos, offset))
+			: index.find_first_offset(m_region.chrom_id, m_region.first_pos - 1, m_region.last_pos, offset)))
+		{
+			std::cerr << "The index has no records in the given region." << std::endl;
+			return;
+		}
+		
+		// The lines before the offset are not read, so the line numbers are relative to the first indexed record.
+		if (bcf_reader)
+			bcf_reader->set_first_variant_offset(offset);
+		else
+			bgzf_input->set_first_variant_offset(offset);
+		std::cerr << "Note: line numbers are counted from the first record read from the index, not from the beginning of the file." << std::endl;
+	}
+	
+	
+	void generate_context::check_ploidy()
+	{
+		size_t i(0);
+		m_vcf_reader->reset();
+		m_vcf_reader->set_parsed_fields(v2m::vcf_field::ALL);
+		
+		v2m::vcf_reader_cursor cursor(*m_vcf_reader);
+		auto const *var(cursor.next());
+		if (!var)
 			v2m::fail("Unable to read the first variant");
+		
+		for (auto const &kv : m_vcf_reader->sample_names())
+		{
+			auto const sample_no(kv.second);
+			m_ploidy[sample_no] = var->sample(sample_no).ploidy();
 		}
 	}
 	
 	
 	void generate_context::check_ref()
 	{
-		m_vcf_reader.reset();
-		m_vcf_reader.set_parsed_fields(v2m::vcf_field::REF);
+		m_vcf_reader->reset();
+		m_vcf_reader->set_parsed_fields(v2m::vcf_field::REF);
 		bool found_mismatch(false);
 		std::size_t i(0);
 		
+		// Only POS, REF and the line number are needed, so handle the records in batches.
+		v2m::vcf_record_batch batch(4096);
 		bool should_continue(false);
 		do {
-			m_vcf_reader.fill_buffer();
-			should_continue = m_vcf_reader.parse(
+			m_vcf_reader->fill_buffer();
+			should_continue = m_vcf_reader->parse(
+				batch,
 				[this, &found_mismatch, &i]
-				(v2m::transient_variant const &var)
+				(v2m::vcf_record_batch const &batch)
 				-> bool
 			{
-				auto const var_ref(var.ref());
-				auto const var_pos(var.zero_based_pos());
-				auto const lineno(var.lineno());
-				std::size_t diff_pos{0};
-			
-				if (!compare_references(m_reference, var_ref, var_pos, diff_pos))
+				auto const count(batch.size());
+				auto const *pos(batch.pos());
+				auto const *ref(batch.ref());
+				auto const *lineno(batch.lineno());
+				for (std::size_t j(0); j < count; ++j)
 				{
-					if (!found_mismatch)
+					v2m::always_assert(0 != pos[j], "Unexpected position");
+					std::size_t diff_pos{0};
+				
+					if (!compare_references(m_reference, ref[j], pos[j] - 1, diff_pos))
 					{
-						found_mismatch = true;
-						std::cerr << "Reference differs from the variant file on line " << lineno << " (and possibly others)." << std::endl;
+						if (!found_mismatch)
+						{
+							found_mismatch = true;
+							std::cerr << "Reference differs from the variant file on line " << lineno[j] << " (and possibly others)." << std::endl;
+						}
+					
+						m_error_logger.log_ref_mismatch(lineno[j], diff_pos);
 					}
-				
-					m_error_logger.log_ref_mismatch(lineno, diff_pos);
+					
+					++i;
+					if (0 == i % 100000)
+						std::cerr << "Handled " << i << " variants…" << std::endl;
 				}
 				
-				++i;
-				if (0 == i % 100000)
-					std::cerr << "Handled " << i << " variants…" << std::endl;
-				
 				return true;
 			});
 		} while (should_continue);
@@ -619,11 +1050,12 @@ namespace {
 			}
 			
 			// After calling cleanup *this is no longer valid.
-			//std::cerr << "Calling cleanup" << std::endl;
+			auto *runner(m_pipeline_runner);
+			auto const pipeline_idx(m_pipeline_idx);
+			auto const output_descriptor_count(m_output_descriptor_count);
 			cleanup();
-			
-			//std::cerr << "Calling exit" << std::endl;
-			exit(EXIT_SUCCESS);
+			runner->pipeline_did_finish(pipeline_idx, output_descriptor_count);
+			return;
 		}
 		
 		++m_current_round;
@@ -650,6 +1082,113 @@ namespace {
 	}
 	
 	
+	// Add the prefix to the last component of the path.
+	std::string generate_context::output_fname(std::string const &fname) const
+	{
+		auto const slash_pos(fname.rfind('/'));
+		if (std::string::npos == slash_pos)
+			return m_output_prefix + fname;
+		
+		std::string retval(fname, 0, 1 + slash_pos);
+		retval += m_output_prefix;
+		retval.append(fname, 1 + slash_pos, std::string::npos);
+		return retval;
+	}
+	
+	
+	bool pipeline_runner::next_pipeline(std::size_t &idx)
+	{
+		std::lock_guard <std::mutex> guard(m_mutex);
+		if (m_next_pipeline == m_pipeline_count || m_running_count == m_max_running_count)
+			return false;
+		
+		// Start the pipelines in order. Let at least one run even if the memory limit is too low.
+		auto const memory_usage(m_memory_usage.empty() ? 0 : m_memory_usage[m_next_pipeline]);
+		if (m_running_count && m_memory_limit < m_reserved_memory + memory_usage)
+			return false;
+		
+		idx = m_next_pipeline++;
+		++m_running_count;
+		m_reserved_descriptors += m_fixed_descriptor_count;
+		m_reserved_memory += memory_usage;
+		return true;
+	}
+	
+	
+	// Called with m_mutex held. Let at least one pipeline proceed even if the limit is too low.
+	bool pipeline_runner::can_reserve_descriptors(std::size_t const count) const
+	{
+		return 0 == m_output_reservation_count || m_reserved_descriptors + count <= m_descriptor_limit;
+	}
+	
+	
+	void pipeline_runner::reserve_output_descriptors(std::size_t const count, reservation_fn &&fn)
+	{
+		{
+			std::lock_guard <std::mutex> guard(m_mutex);
+			
+			// Handle the requests in order so that none of the pipelines waits indefinitely.
+			if (! (m_descriptor_requests.empty() && can_reserve_descriptors(count)))
+			{
+				std::cerr << "Waiting for other pipelines to finish before opening " << count << " output files…" << std::endl;
+				m_descriptor_requests.emplace_back(count, std::move(fn));
+				return;
+			}
+			
+			m_reserved_descriptors += count;
+			++m_output_reservation_count;
+		}
+		
+		fn();
+	}
+	
+	
+	void pipeline_runner::start(std::size_t const max_running_count)
+	{
+		m_max_running_count = max_running_count;
+		
+		std::size_t idx(0);
+		while (next_pipeline(idx))
+			m_start_fn(*this, idx);
+	}
+	
+	
+	void pipeline_runner::pipeline_did_finish(std::size_t const idx, std::size_t const output_descriptor_count)
+	{
+		std::vector <reservation_fn> granted_requests;
+		{
+			std::lock_guard <std::mutex> guard(m_mutex);
+			++m_finished_count;
+			if (m_finished_count == m_pipeline_count)
+				exit(EXIT_SUCCESS);
+			
+			m_reserved_descriptors -= m_fixed_descriptor_count + output_descriptor_count;
+			--m_output_reservation_count;
+			--m_running_count;
+			if (!m_memory_usage.empty())
+				m_reserved_memory -= m_memory_usage[idx];
+			
+			// Let the waiting pipelines continue.
+			while (!m_descriptor_requests.empty() && can_reserve_descriptors(m_descriptor_requests.front().count))
+			{
+				auto &req(m_descriptor_requests.front());
+				m_reserved_descriptors += req.count;
+				++m_output_reservation_count;
+				granted_requests.emplace_back(std::move(req.fn));
+				m_descriptor_requests.pop_front();
+			}
+		}
+		
+		for (auto &fn : granted_requests)
+			fn();
+		
+		// Replace the finished pipeline with the next ones that fit into the memory limit.
+		std::size_t next_idx(0);
+		while (next_pipeline(next_idx))
+			m_start_fn(*this, next_idx);
+	}
+	
+	
 	void generate_context::set_variant_handler_delegate(std::unique_ptr <v2m::variant_handler_delegate> &&delegate)
 	{
 		m_variant_handler_delegate = std::move(delegate);
@@ -659,27 +1198,49 @@ namespace {
 	
 	void generate_context::load_and_generate(
 		char const *reference_fname,
-		char const *variants_fname,
+		std::vector <std::string> const &variants_fnames,
 		char const *report_fname,
-		bool const should_check_ref
+		bool const should_check_ref,
+		bool const should_use_line_index
 	)
 	{
 		// Open the files.
 		std::cerr << "Opening files…" << std::endl;
 		{
 			v2m::file_istream ref_fasta_stream;
+			auto const *variants_fname(variants_fnames.front().c_str());
 			
 			open_file_for_reading(reference_fname, ref_fasta_stream);
-			open_file_for_reading(variants_fname, m_vcf_stream);
+			if (1 == variants_fnames.size())
+				m_vcf_is_temporary = open_vcf_input(variants_fname, m_vcf_stream, m_vcf_input, m_vcf_reader, 0 == m_sort_buffer_size);
+			else
+				open_vcf_partitions(variants_fnames);
+			m_variant_handler.set_vcf_reader(*m_vcf_reader);
+			
+			if (m_vcf_input)
+			{
+				m_vcf_input->set_preferred_buffer_size(m_input_buffer_size);
+				m_vcf_input->set_read_ahead_buffer_count(m_read_ahead_buffer_count);
+			}
 			
 			if (report_fname)
 			{
-				open_file_for_writing(report_fname, m_error_logger.output_stream(), m_should_overwrite_files);
+				open_file_for_writing(output_fname(report_fname).c_str(), m_error_logger.output_stream(), m_should_overwrite_files);
 				m_error_logger.write_header();
 			}
 			
-			m_vcf_reader.set_stream(m_vcf_stream);
-			m_vcf_reader.read_header();
+			m_vcf_reader->read_header();
+			m_vcf_reader->set_parser_thread_count(m_parser_thread_count, m_split_line_length);
+			
+			if (m_sort_buffer_size)
+				sort_variants();
+			
+			if (should_use_line_index)
+				load_line_index(variants_fname);
+			
+			// Restrict the passes to the given region.
+			if (m_region.is_set())
+				prepare_region(variants_fname);
 			
 			// Read the reference file and place its contents into reference.
 			v2m::read_single_fasta_seq(ref_fasta_stream, m_reference);
@@ -689,6 +1250,25 @@ namespace {
 		std::cerr << "Checking ploidy…" << std::endl;
 		check_ploidy();
 		
+		// Each round keeps one file open for each haplotype and possibly one for the reference.
+		{
+			std::size_t max_ploidy(1);
+			for (auto const &kv : m_ploidy)
+				max_ploidy = std::max(max_ploidy, kv.second);
+			m_output_descriptor_count = 1 + m_chunk_size * max_ploidy;
+		}
+		
+		// Continue when the output files may be opened without exceeding the open file limit.
+		m_pipeline_runner->reserve_output_descriptors(m_output_descriptor_count, [this, should_check_ref](){
+			v2m::dispatch_async_fn(m_variant_handler.main_queue(), [this, should_check_ref](){
+				check_and_generate(should_check_ref);
+			});
+		});
+	}
+	
+	
+	void generate_context::check_and_generate(bool const should_check_ref)
+	{
 		// Compare REF to the reference vector.
 		if (should_check_ref)
 		{
@@ -701,9 +1281,10 @@ namespace {
 		{
 			std::cerr << "Checking overlapping variants…" << std::endl;
 			auto const conflict_count(v2m::check_overlapping_non_nested_variants(
-				m_vcf_reader,
+				*m_vcf_reader,
 				m_sv_handling_method,
 				m_skipped_variants,
+				m_valid_alts,
 				m_error_logger
 			));
 	
@@ -734,7 +1315,7 @@ namespace {
 		auto it(create_haplotype(haplotypes, v2m::REF_SAMPLE_NUMBER, 1));
 		auto &haplotype_vec(it->second);
 		open_file_for_writing(
-			m_generate_context->out_reference_fname().c_str(),
+			m_generate_context->output_fname(m_generate_context->out_reference_fname()).c_str(),
 			haplotype_vec[0].output_stream,
 			m_generate_context->should_overwrite_files()
 		);
@@ -779,7 +1360,7 @@ namespace {
 		
 			for (size_t j(1); j <= current_ploidy; ++j)
 			{
-				auto const fname(boost::str(boost::format("%s-%u") % sample_name % j));
+				auto const fname(m_generate_context->output_fname(boost::str(boost::format("%s-%u") % sample_name % j)));
 				open_file_for_writing(fname.c_str(), haplotype_vec[j - 1].output_stream, should_overwrite_files);
 			}
 	
@@ -829,7 +1410,7 @@ namespace {
 			auto const sample_id(1 + m_sample_idx);
 			auto it(find_or_create_haplotype(haplotypes, sample_id, 1));
 			auto &haplotype_vec(it->second);
-			auto const fname(boost::str(boost::format("%u") % sample_id));
+			auto const fname(m_generate_context->output_fname(boost::str(boost::format("%u") % sample_id)));
 			open_file_for_writing(fname.c_str(), haplotype_vec[0].output_stream, m_generate_context->should_overwrite_files());
 			
 			++m_sample_idx;
@@ -841,7 +1422,7 @@ namespace {
 	}
 	
 	
-	void vh_stats <true>::assigned_alt_to_sequence(std::size_t const alt_idx)
+	inline void vh_stats <true>::assigned_alt_to_sequence(std::size_t const alt_idx)
 	{
 		++m_non_ref_totals.handled_count;
 		++m_counts_by_alt[alt_idx].handled_count;
@@ -855,7 +1436,7 @@ namespace {
 		uint8_t const chr_idx
 	)
 	{
-		if (m_overlapping_alts.insert(lineno).second)
+		if (m_overlapping_alts.insert(lineno))
 		{
 			std::cerr << "Overlapping alternatives on line " << lineno
 			<< " for sample " << sample_no << ':' << (int) chr_idx
@@ -875,7 +1456,7 @@ namespace {
 	}
 	
 	
-	void vh_stats <true>::handled_alt(std::size_t const alt_idx)
+	inline void vh_stats <true>::handled_alt(std::size_t const alt_idx)
 	{
 		++m_non_ref_totals.total_count;
 		++m_counts_by_alt[alt_idx].total_count;
@@ -895,37 +1476,10 @@ namespace {
 	}
 	
 	
-	v2m::vcf_reader::sample_name_map const &vh_delegate::sample_names() const
-	{
-		return m_ctx->vcf_reader().sample_names();
-	}
-	
-	
-	bool vh_delegate::is_valid_alt(std::size_t const alt_idx) const
-	{
-		return m_ctx->variant_handler().is_valid_alt(alt_idx);
-	}
-	
-	
-	std::set <std::size_t> const &vh_delegate::valid_alts(v2m::variant &var) const
-	{
-		return m_ctx->variant_handler().valid_alts();
-	}
-	
-	
-	void vh_delegate::enumerate_genotype(
-		v2m::variant &var,
-		std::size_t const sample_no,
-		std::function <void(uint8_t, std::size_t, bool)> const &cb
-	)
-	{
-		return m_ctx->variant_handler().enumerate_genotype(var, sample_no, cb);
-	}
-	
-	
 	void compress_vh_delegate::prepare(v2m::vcf_reader &reader)
 	{
 		reader.set_parsed_fields(v2m::vcf_field::ALL);
+		reader.parse_all_samples();
 		m_sample_reducer.prepare();
 	}
 	
@@ -949,7 +1503,8 @@ namespace {
 	}
 	
 	
-	void vh_sequence_writer::finish()
+	template <typename t_delegate>
+	void vh_sequence_writer <t_delegate>::finish()
 	{
 		m_sequence_writer.finish();
 		auto &ctx(this->generate_context());
@@ -1011,7 +1566,7 @@ namespace {
 			{
 				uint8_t alt_idx(0);
 				if (it.front().second.get_alt(var.lineno(), alt_idx))
-					m_valid_alts.emplace(alt_idx);
+					m_valid_alts.insert(alt_idx);
 			}
 		}
 		
@@ -1019,42 +1574,45 @@ namespace {
 	}
 	
 	
-	void read_compressed_vh_delegate::enumerate_genotype(
-		v2m::variant &var,
-		std::size_t const sample_no,
-		std::function <void(uint8_t, std::size_t, bool)> const &cb
-	)
+	template <typename t_cb>
+	void read_compressed_vh_delegate::enumerate_carriers(v2m::variant &var, t_cb &&cb)
 	{
-		auto const &sample_map(m_compressed_ranges->at(sample_no));
-		if (0 == sample_map.size())
-		{
-			cb(0, 0, true);
-			return;
-		}
-
-		// Find the variant_sequence that starts after the current position.
-		// If the found sequence is the first one, output REF.
 		auto const pos(var.pos());
-		auto it(sample_map.upper_bound(pos));
-		if (sample_map.cbegin() == it)
+		auto const lineno(var.lineno());
+		for (auto const &kv : m_ctx->haplotypes())
 		{
-			cb(0, 0, true);
-			return;
+			auto const sample_no(kv.first);
+			auto const &sample_map(m_compressed_ranges->at(sample_no));
+			
+			// Find the variant_sequence that starts after the current position.
+			// If the found sequence is the first one, the sample has REF.
+			auto it(sample_map.upper_bound(pos));
+			if (sample_map.cbegin() == it)
+				continue;
+			
+			// Make it point to the variant_sequence that starts before the current position.
+			--it;
+			uint8_t alt_idx(0);
+			auto const &var_seq(it->second);
+			if (var_seq.get_alt(lineno, alt_idx) && alt_idx)
+				cb(sample_no, 0, alt_idx);
 		}
-
-		// Make it point to the variant_sequence that starts before the current position.
-		--it;
-		uint8_t alt_idx(0);
-		auto const lineno(var.lineno());
-		auto const &var_seq(it->second);
-		var_seq.get_alt(lineno, alt_idx);	// alt_idx remains zero if get_alt returns false.
-		cb(0, alt_idx, true);
 	}
 	
 	
 	void all_genotypes_vh_delegate::prepare(v2m::vcf_reader &reader)
 	{
 		reader.set_parsed_fields(v2m::vcf_field::ALL);
+		
+		// Parse only the samples handled in the current round.
+		std::vector <bool> mask(1 + reader.sample_count(), false);
+		for (auto const &kv : m_ctx->haplotypes())
+		{
+			auto const sample_no(kv.first);
+			if (v2m::REF_SAMPLE_NUMBER != sample_no)
+				mask[sample_no] = true;
+		}
+		reader.set_parsed_samples(mask);
 		m_sequence_writer.prepare(m_ctx->haplotypes());
 	}
 	
@@ -1070,46 +1628,201 @@ namespace {
 namespace vcf2multialign {
 	
 	void generate_haplotypes(
-		char const *reference_fname,
-		char const *variants_fname,
+		std::vector <input_files> const &input_files,
 		char const *out_reference_fname,
 		char const *report_fname,
 		char const *null_allele_seq,
+		char const *region,
 		std::size_t const chunk_size,
+		std::size_t const parser_thread_count,
+		std::size_t const split_line_length,
+		std::size_t const max_pipeline_count,
+		std::size_t const max_memory,
+		std::size_t const input_buffer_size,
+		std::size_t const read_ahead_buffer_count,
+		std::size_t const sort_buffer_size,
 		std::size_t const variant_padding,
 		sv_handling const sv_handling_method,
 		bool const should_overwrite_files,
 		bool const should_check_ref,
 		bool const should_reduce_samples,
-		bool const allow_switch_to_ref
+		bool const allow_switch_to_ref,
+		bool const should_use_line_index
 	)
 	{
-		dispatch_ptr <dispatch_queue_t> main_queue(dispatch_get_main_queue(), true);
-		dispatch_ptr <dispatch_queue_t> parsing_queue(
-			dispatch_queue_create("fi.iki.tsnorri.vcf2multialign.parsing_queue", DISPATCH_QUEUE_SERIAL),
-			false
-		);
+		always_assert(!input_files.empty(), "No input files given");
 		
-		// generate_context needs to be allocated on the heap because later dispatch_main is called.
-		// The class deallocates itself in cleanup().
-		generate_context *ctx(new generate_context(
-			std::move(main_queue),
-			std::move(parsing_queue),
-			out_reference_fname,
-			null_allele_seq,
-			sv_handling_method,
-			chunk_size,
-			variant_padding,
-			should_overwrite_files,
-			should_reduce_samples,
-			allow_switch_to_ref
-		));
+		// Distinguish the output files of the pipelines by the reference file names.
+		std::vector <std::string> output_prefixes(input_files.size());
+		if (1 < input_files.size())
+		{
+			for (std::size_t i(0); i < input_files.size(); ++i)
+			{
+				auto &prefix(output_prefixes[i]);
+				std::string const reference_fname(input_files[i].reference_fname);
+				auto const slash_pos(reference_fname.rfind('/'));
+				auto const start_pos(std::string::npos == slash_pos ? 0 : 1 + slash_pos);
+				auto const dot_pos(reference_fname.find('.', start_pos));
+				prefix.assign(reference_fname, start_pos, (std::string::npos == dot_pos ? dot_pos : dot_pos - start_pos));
+				prefix += '.';
+			}
 			
-		ctx->load_and_generate(
-			reference_fname,
-			variants_fname,
-			report_fname,
-			should_check_ref
-		);
+			std::vector <std::string> sorted_prefixes(output_prefixes);
+			std::sort(sorted_prefixes.begin(), sorted_prefixes.end());
+			always_assert(
+				sorted_prefixes.cend() == std::adjacent_find(sorted_prefixes.cbegin(), sorted_prefixes.cend()),
+				"The reference file names need to be distinct up to the first period"
+			);
+		}
+		
+		// Each pipeline keeps one file open for each haplotype in the current round.
+		// The ploidy is not known yet, so if not given, determine the number of concurrent
+		// pipelines from the file descriptor limit assuming one haplotype per sample.
+		// The pipelines then reserve the descriptors for their output files in pipeline_runner.
+		std::size_t descriptor_limit(SIZE_MAX);
+		{
+			struct rlimit rl;
+			if (0 == getrlimit(RLIMIT_NOFILE, &rl) && RLIM_INFINITY != rl.rlim_cur)
+				descriptor_limit = (16 < rl.rlim_cur ? rl.rlim_cur - 16 : 0);
+		}
+		
+		// The sorter keeps its runs open until they have been merged.
+		std::size_t const fixed_descriptor_count(pipeline_runner::FIXED_DESCRIPTOR_COUNT + (sort_buffer_size ? v2m::vcf_sorter::DESCRIPTOR_COUNT : 0));
+		std::size_t pipeline_count(max_pipeline_count);
+		if (0 == pipeline_count)
+		{
+			pipeline_count = 1;
+			if (SIZE_MAX != descriptor_limit)
+				pipeline_count = std::max <std::size_t>(1, descriptor_limit / (fixed_descriptor_count + 1 + chunk_size));
+			else
+				pipeline_count = input_files.size();
+		}
+		pipeline_count = std::min(pipeline_count, input_files.size());
+		
+		// The option values are freed before the pipelines are started, so copy them.
+		struct pipeline_input
+		{
+			std::string reference_fname;
+			std::vector <std::string> variants_fnames;
+			std::string output_prefix;
+		};
+		
+		std::vector <pipeline_input> pipeline_inputs(input_files.size());
+		for (std::size_t i(0); i < input_files.size(); ++i)
+		{
+			auto &input(pipeline_inputs[i]);
+			input.reference_fname = input_files[i].reference_fname;
+			input.variants_fnames.assign(input_files[i].variants_fnames.begin(), input_files[i].variants_fnames.end());
+			input.output_prefix = std::move(output_prefixes[i]);
+		}
+		
+		// Estimate the memory used by each pipeline from the size of the reference file,
+		// the parsed records in flight and the input and sort buffers. The output buffers
+		// and the handled variants are not counted. If not given, the limit is the amount
+		// of physical memory.
+		std::size_t memory_limit(max_memory);
+		if (0 == memory_limit)
+		{
+			auto const page_count(sysconf(_SC_PHYS_PAGES));
+			auto const page_size(sysconf(_SC_PAGESIZE));
+			memory_limit = (0 < page_count && 0 < page_size ? std::size_t(page_count) * page_size : SIZE_MAX);
+		}
+		
+		std::vector <std::size_t> memory_usage(input_files.size());
+		for (std::size_t i(0); i < input_files.size(); ++i)
+		{
+			auto const &input(pipeline_inputs[i]);
+			struct stat sb;
+			auto &usage(memory_usage[i]);
+			usage = (0 == stat(input.reference_fname.c_str(), &sb) ? sb.st_size : 0);
+			usage += v2m::variant_buffer::MAX_BYTES_IN_FLIGHT + sort_buffer_size;
+			usage += input.variants_fnames.size() * input_buffer_size * (1 + read_ahead_buffer_count);
+		}
+		
+		auto const copy_optional([](char const *str) -> boost::optional <std::string> {
+			if (str)
+				return std::string(str);
+			return boost::none;
+		});
+		auto const c_str([](boost::optional <std::string> const &str) -> char const * {
+			return (str ? str->c_str() : nullptr);
+		});
+		
+		// The runner exits the program after the last pipeline has finished.
+		auto *runner(new pipeline_runner(
+			pipeline_inputs.size(),
+			[
+				pipeline_inputs = std::move(pipeline_inputs),
+				out_reference_fname = copy_optional(out_reference_fname),
+				report_fname = copy_optional(report_fname),
+				region = copy_optional(region),
+				null_allele_seq = std::string(null_allele_seq),
+				c_str,
+				chunk_size,
+				parser_thread_count,
+				split_line_length,
+				input_buffer_size,
+				read_ahead_buffer_count,
+				sort_buffer_size,
+				variant_padding,
+				sv_handling_method,
+				should_overwrite_files,
+				should_check_ref,
+				should_reduce_samples,
+				allow_switch_to_ref,
+				should_use_line_index
+			](pipeline_runner &runner, std::size_t const idx){
+				auto const &input(pipeline_inputs[idx]);
+				
+				// Use a separate serial queue for each pipeline in place of the main queue.
+				dispatch_ptr <dispatch_queue_t> handling_queue(
+					dispatch_queue_create("fi.iki.tsnorri.vcf2multialign.handling_queue", DISPATCH_QUEUE_SERIAL),
+					false
+				);
+				dispatch_ptr <dispatch_queue_t> parsing_queue(
+					dispatch_queue_create("fi.iki.tsnorri.vcf2multialign.parsing_queue", DISPATCH_QUEUE_SERIAL),
+					false
+				);
+				auto queue(*handling_queue);
+				
+				// generate_context needs to be allocated on the heap because later dispatch_main is called.
+				// The class deallocates itself in cleanup().
+				generate_context *ctx(new generate_context(
+					std::move(handling_queue),
+					std::move(parsing_queue),
+					c_str(out_reference_fname),
+					null_allele_seq.c_str(),
+					c_str(region),
+					sv_handling_method,
+					chunk_size,
+					parser_thread_count,
+					split_line_length,
+					input_buffer_size,
+					read_ahead_buffer_count,
+					sort_buffer_size,
+					variant_padding,
+					should_overwrite_files,
+					should_reduce_samples,
+					allow_switch_to_ref
+				));
+				ctx->set_pipeline_runner(runner, idx, input.output_prefix);
+				
+				// The runner and thus the captured values remain valid until exit.
+				dispatch_async_fn(queue, [ctx, &input, &report_fname, c_str, should_check_ref, should_use_line_index](){
+					ctx->load_and_generate(
+						input.reference_fname.c_str(),
+						input.variants_fnames,
+						c_str(report_fname),
+						should_check_ref,
+						should_use_line_index
+					);
+				});
+			}
+		));
+		
+		runner->set_descriptor_limit(descriptor_limit);
+		runner->set_fixed_descriptor_count(fixed_descriptor_count);
+		runner->set_memory_limit(memory_limit, std::move(memory_usage));
+		runner->start(pipeline_count);
 	}
 }
@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <unistd.h>
+#include <vector>
 #include <vcf2multialign/dispatch_fn.hh>
 #include <vcf2multialign/generate_haplotypes.hh>
 #include <vcf2multialign/util.hh>
@@ -51,6 +52,56 @@ int main(int argc, char **argv)
 		std::cerr << "Chunk size must be positive." << std::endl;
 		exit(EXIT_FAILURE);
 	}
+	
+	if (args_info.merge_samples_flag)
+	{
+		if (1 != args_info.reference_given)
+		{
+			std::cerr << "Only one reference file may be given when merging the samples of the variant files." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+	else if (args_info.reference_given != args_info.variants_given)
+	{
+		std::cerr << "The number of reference files must match the number of variant files." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	
+	if (args_info.max_pipelines_given && args_info.max_pipelines_arg <= 0)
+	{
+		std::cerr << "The maximum number of pipelines must be positive." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	
+	if (args_info.memory_limit_given && args_info.memory_limit_arg <= 0)
+	{
+		std::cerr << "The memory limit must be positive." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	
+	if (args_info.parser_threads_arg <= 0)
+	{
+		std::cerr << "The number of parser threads must be positive." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	
+	if (args_info.split_lines_given && args_info.split_lines_arg <= 0)
+	{
+		std::cerr << "The minimum length of split lines must be positive." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	
+	if (args_info.input_buffer_size_arg <= 0 || args_info.read_ahead_buffers_arg <= 0)
+	{
+		std::cerr << "The input buffer size and the number of read-ahead buffers must be positive." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	
+	if (args_info.sort_buffer_size_arg <= 0)
+	{
+		std::cerr << "The sort buffer size must be positive." << std::endl;
+		exit(EXIT_FAILURE);
+	}
 
 	std::ios_base::sync_with_stdio(false);	// Don't use C style IO after calling cmdline_parser.
 	std::cin.tie(nullptr);					// We don't require any input from the user.
@@ -64,19 +115,42 @@ int main(int argc, char **argv)
 	pthread_workqueue_init_np();
 #endif
 
+	std::vector <v2m::input_files> input_files(args_info.reference_given);
+	if (args_info.merge_samples_flag)
+	{
+		input_files.front().reference_fname = args_info.reference_arg[0];
+		input_files.front().variants_fnames.assign(args_info.variants_arg, args_info.variants_arg + args_info.variants_given);
+	}
+	else
+	{
+		for (unsigned int i(0); i < args_info.reference_given; ++i)
+		{
+			input_files[i].reference_fname = args_info.reference_arg[i];
+			input_files[i].variants_fnames.push_back(args_info.variants_arg[i]);
+		}
+	}
+	
 	v2m::generate_haplotypes(
-		args_info.reference_arg,
-		args_info.variants_arg,
+		input_files,
 		args_info.output_reference_arg,
 		args_info.report_file_arg,
 		args_info.null_allele_seq_arg,
+		args_info.region_arg,
 		args_info.chunk_size_arg,
+		args_info.parser_threads_arg,
+		(args_info.split_lines_given ? args_info.split_lines_arg : 0),
+		(args_info.max_pipelines_given ? args_info.max_pipelines_arg : 0),
+		(args_info.memory_limit_given ? args_info.memory_limit_arg : 0),
+		args_info.input_buffer_size_arg,
+		args_info.read_ahead_buffers_arg,
+		(args_info.sort_flag ? args_info.sort_buffer_size_arg : 0),
 		args_info.variant_padding_arg,
 		sv_handling_method(args_info.structural_variants_arg),
 		args_info.overwrite_flag,
 		!args_info.no_check_ref_flag,
 		args_info.reduce_samples_flag,
-		args_info.allow_switch_to_ref_flag
+		args_info.allow_switch_to_ref_flag,
+		args_info.line_index_flag
 	);
 		
 	cmdline_parser_free(&args_info);
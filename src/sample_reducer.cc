@@ -28,7 +28,7 @@ namespace vcf2multialign {
 	
 	
 	// Check whether prepared_sequences already contains seq.
-	bool sample_reducer::prepared_contains_sequence(variant_sequence const &seq) const
+	bool sample_reducer_base::prepared_contains_sequence(variant_sequence const &seq) const
 	{
 		auto it(m_prepared_sequences.find(seq.start_pos()));
 		if (m_prepared_sequences.cend() == it)
@@ -45,7 +45,7 @@ namespace vcf2multialign {
 	
 	
 	// Move seq to prepared_sequences if it hasn't been already added.
-	void sample_reducer::check_and_copy_seq_to_prepared(variant_sequence &seq)
+	void sample_reducer_base::check_and_copy_seq_to_prepared(variant_sequence &seq)
 	{
 		auto const start_pos(seq.start_pos_1());
 		if (!(0 == start_pos || prepared_contains_sequence(seq)))
@@ -60,7 +60,7 @@ namespace vcf2multialign {
 	
 	
 	// Move variant_seq to prepared_sequences if there are no variants in the padding distance.
-	bool sample_reducer::check_variant_sequence(
+	bool sample_reducer_base::check_variant_sequence(
 		variant_sequence &seq,
 		variant_sequence_id const &seq_id,
 		std::size_t const zero_based_pos
@@ -87,74 +87,14 @@ namespace vcf2multialign {
 	}
 	
 	
-	// Create subsequences.
-	void sample_reducer::handle_variant(variant &var)
-	{
-		// Verify that the positions are in increasing order.
-		auto const lineno(var.lineno());
-		auto const pos(var.zero_based_pos());
-		auto const end(pos + var.ref().size());
-		
-		always_assert(m_last_position <= pos, "Positions not in increasing order");
-		
-		for (auto const &kv : m_delegate->sample_names())
-		{
-			auto const sample_no(kv.second);
-			
-			// Handle the genotype.
-			m_delegate->enumerate_genotype(var, sample_no,
-				[
-					this,
-					lineno,
-					pos,
-					end,
-					sample_no
-				](
-					uint8_t const chr_idx, std::size_t const alt_idx, bool const is_phased
-				) {
-					always_assert(0 == chr_idx || is_phased, "Variant file not phased");
-			
-					if (0 != alt_idx && m_delegate->is_valid_alt(alt_idx))
-					{
-						// If the current variant references an ALT column value in a chromosome, add the
-						// ALT index to the corresponding sequence.
-						if (alt_idx)
-						{
-							variant_sequence_id seq_id(sample_no, chr_idx);
-							variant_sequence &seq(m_variant_sequences[seq_id]);
-					
-							// First check if the previous variant is beyond the padding distance.
-							if (check_variant_sequence(seq, seq_id, pos))
-							{
-								seq.add_alt(lineno, pos, alt_idx);
-								m_delegate->assigned_alt_to_sequence(alt_idx);
-							}
-							else
-							{
-								auto const sample_no(seq.sample_no());
-								auto const chr_idx(seq.chr_idx());
-								m_delegate->found_overlapping_alt(lineno, alt_idx, sample_no, chr_idx);
-							}
-					
-							m_delegate->handled_alt(alt_idx);
-						}
-					}
-				}
-			);
-		}
-			
-		m_last_position = pos;
-	}
-	
-	
-	void sample_reducer::prepare()
+	void sample_reducer_base::prepare()
 	{
 		std::cerr << "Reducing samples… " << std::endl;
 		m_last_position = 0;
 	}
 	
 	
-	void sample_reducer::finish()
+	void sample_reducer_base::finish()
 	{
 		// Add the remaining ranges.
 		for (auto &kv : m_variant_sequences)
@@ -167,7 +107,7 @@ namespace vcf2multialign {
 	}
 	
 	
-	void sample_reducer::print_prepared_sequences()
+	void sample_reducer_base::print_prepared_sequences()
 	{
 		for (auto const &kv : m_prepared_sequences)
 		{
@@ -180,7 +120,7 @@ namespace vcf2multialign {
 	}
 	
 	
-	void sample_reducer::assign_ranges_greedy()
+	void sample_reducer_base::assign_ranges_greedy()
 	{
 		std::cerr << "Assigning variant ranges to new haplotype sequences… " << std::flush;
 		//print_prepared_sequences();
@@ -3,14 +3,25 @@
  This code is licensed under MIT license (see LICENSE for details).
  */
 
+#include <algorithm>
 #include <vcf2multialign/sequence_writer.hh>
 #include <vcf2multialign/variant.hh>
 
 
 namespace vcf2multialign {
 	
+	// Find the haplotypes of the given ALT without copying it if it has been added already.
+	haplotype_ptr_map &sequence_writer_base::alt_haplotypes(std::string_view const &alt)
+	{
+		auto it(m_alt_haplotypes.find(alt));
+		if (m_alt_haplotypes.end() == it)
+			it = m_alt_haplotypes.emplace(std::string(alt), haplotype_ptr_map()).first;
+		return it->second;
+	}
+	
+	
 	// Fill the streams with '-'.
-	void sequence_writer::fill_streams(haplotype_ptr_map &haplotypes, size_t const fill_amt) const
+	void sequence_writer_base::fill_streams(haplotype_ptr_map &haplotypes, size_t const fill_amt) const
 	{
 		for (auto &kv : haplotypes)
 		{
@@ -27,7 +38,7 @@ namespace vcf2multialign {
 
 	
 	// Fill the streams with reference.
-	void sequence_writer::output_reference(std::size_t const output_start_pos, std::size_t const output_end_pos)
+	void sequence_writer_base::output_reference(std::size_t const output_start_pos, std::size_t const output_end_pos)
 	{
 		if (output_start_pos == output_end_pos)
 			return;
@@ -53,7 +64,7 @@ namespace vcf2multialign {
 	}
 
 	
-	std::size_t sequence_writer::process_overlap_stack(size_t const var_pos)
+	std::size_t sequence_writer_base::process_overlap_stack(size_t const var_pos)
 	{
 		std::size_t retval(0);
 		while (true)
@@ -166,7 +177,31 @@ namespace vcf2multialign {
 	}
 	
 	
-	void sequence_writer::handle_variant(variant &var)
+	std::string_view sequence_writer_base::alt_string(variant const &var, std::size_t const alt_idx) const
+	{
+		if (NULL_ALLELE == alt_idx)
+			return *m_null_allele_seq;
+		
+		switch (var.alt_sv_types()[alt_idx - 1])
+		{
+			case sv_type::NONE:
+				return var.alts()[alt_idx - 1];
+				
+			case sv_type::DEL:
+			case sv_type::DEL_ME:
+				return std::string_view("");
+				
+			default:
+				fail("Unexpected structural variant type.");
+				break;
+		}
+		
+		return std::string_view("");
+	}
+	
+	
+	// Output the reference up to the position of var and return the variant_overlap that contains it.
+	variant_overlap &sequence_writer_base::output_up_to_variant(variant const &var)
 	{
 		auto const var_pos(var.zero_based_pos());
 		auto const lineno(var.lineno());
@@ -177,10 +212,7 @@ namespace vcf2multialign {
 			<< std::endl;
 		});
 		
-		auto const var_ref(var.ref());
-		auto const var_ref_size(var_ref.size());
-		auto const var_alts(var.alts());
-		auto const var_alt_sv_types(var.alt_sv_types());
+		auto const var_ref_size(var.ref().size());
 		
 		// If var is beyond previous_variant.end_pos, handle the variants on the stack
 		// until a containing variant is found or the bottom of the stack is reached.
@@ -215,109 +247,43 @@ namespace vcf2multialign {
 		// Also add the length to the heaviest path length.
 		previous_variant.current_pos = var_pos;
 		
-		// Find haplotypes that have the variant.
-		// First make sure that all valid alts are listed in m_alt_haplotypes.
-		std::string const empty_alt("");
-		for (auto const alt_idx : m_delegate->valid_alts(var))
-		{
-			switch (var_alt_sv_types[alt_idx - 1])
-			{
-				case sv_type::NONE:
-				{
-					auto const &alt_str(var_alts[alt_idx - 1]);
-					m_alt_haplotypes[alt_str];
-					break;
-				}
-				
-				case sv_type::DEL:
-				case sv_type::DEL_ME:
-					m_alt_haplotypes[empty_alt];
-					break;
-				
-				default:
-					fail("Unexpected structural variant type.");
-					break;
-			}
-		}
-		m_alt_haplotypes[*m_null_allele_seq];
-		
-		for (auto const &kv : *m_all_haplotypes)
+		return previous_variant;
+	}
+	
+	
+	// Move the haplotype from the reference to the given ALT.
+	void sequence_writer_base::assign_alt_to_haplotype(
+		std::string_view const &alt,
+		std::size_t const sample_no,
+		uint8_t const chr_idx,
+		std::vector <haplotype *> &ref_ptrs
+	)
+	{
+		haplotype_ptr_map &alt_ptrs_by_sample(alt_haplotypes(alt));
+		auto it(alt_ptrs_by_sample.find(sample_no));
+		if (alt_ptrs_by_sample.end() == it)
 		{
-			auto const sample_no(kv.first);
-
-			m_delegate->enumerate_genotype(var, sample_no,
-				[
-					this,
-					sample_no,
-					lineno,
-					&var_alts,
-					&var_alt_sv_types,
-					&empty_alt
-				](
-					uint8_t const chr_idx, std::size_t const alt_idx, bool const is_phased
-				) {
-					always_assert(0 == chr_idx || is_phased, "Variant file not phased");
-				
-					if (0 != alt_idx && m_delegate->is_valid_alt(alt_idx))
-					{
-						auto &ref_ptrs(m_ref_haplotype_ptrs.find(sample_no)->second); // Has nodes for every sample_no.
-						
-						std::string const *alt_ptr{m_null_allele_seq};
-						if (NULL_ALLELE != alt_idx)
-						{
-							switch (var_alt_sv_types[alt_idx - 1])
-							{
-								case sv_type::NONE:
-									alt_ptr = &var_alts[alt_idx - 1];
-									break;
-									
-								case sv_type::DEL:
-								case sv_type::DEL_ME:
-									alt_ptr = &empty_alt;
-									break;
-									
-								default:
-									fail("Unexpected structural variant type.");
-									break;
-							}
-						}
-						
-						haplotype_ptr_map &alt_ptrs_by_sample(m_alt_haplotypes[*alt_ptr]);
-						auto it(alt_ptrs_by_sample.find(sample_no));
-						if (alt_ptrs_by_sample.end() == it)
-						{
-							it = alt_ptrs_by_sample.emplace(
-								std::piecewise_construct,
-								std::forward_as_tuple(sample_no),
-								std::forward_as_tuple(ref_ptrs.size(), nullptr)
-							).first;
-						}
-						auto &alt_ptrs(it->second);
-						
-						if (ref_ptrs[chr_idx])
-						{
-							// Use ADL.
-							using std::swap;
-							swap(alt_ptrs[chr_idx], ref_ptrs[chr_idx]);
-							m_delegate->assigned_alt_to_sequence(alt_idx);
-						}
-						else
-						{
-							m_delegate->found_overlapping_alt(lineno, alt_idx, sample_no, chr_idx);
-						}
-						
-						m_delegate->handled_alt(alt_idx);
-					}
-				}
-			);
+			it = alt_ptrs_by_sample.emplace(
+				std::piecewise_construct,
+				std::forward_as_tuple(sample_no),
+				std::forward_as_tuple(ref_ptrs.size(), nullptr)
+			).first;
 		}
+		auto &alt_ptrs(it->second);
 		
-		m_delegate->handled_haplotypes(var);
-		
+		// Use ADL.
+		using std::swap;
+		swap(alt_ptrs[chr_idx], ref_ptrs[chr_idx]);
+	}
+	
+	
+	void sequence_writer_base::push_variant_overlap(variant const &var, variant_overlap &previous_variant)
+	{
 		// Create a new variant_overlap.
-		auto const var_end(var_pos + var_ref_size);
+		auto const var_pos(var.zero_based_pos());
+		auto const var_end(var_pos + var.ref().size());
 		auto const previous_end_pos(previous_variant.end_pos);
-		variant_overlap overlap(var_pos, var_pos, var_end, 0, lineno, m_alt_haplotypes);
+		variant_overlap overlap(var_pos, var_pos, var_end, 0, var.lineno(), m_alt_haplotypes);
 		if (var_pos < previous_end_pos)
 		{
 			// Add the current variant to the stack.
@@ -333,13 +299,14 @@ namespace vcf2multialign {
 	}
 	
 	
-	void sequence_writer::prepare(haplotype_map &all_haplotypes)
+	void sequence_writer_base::prepare(haplotype_map &all_haplotypes)
 	{
 		while (!m_overlap_stack.empty())
 			m_overlap_stack.pop();
 		
+		auto const output_start(std::min(m_output_start, m_reference->size()));
 		m_ref_haplotype_ptrs.clear();
-		m_overlap_stack.emplace(0, 0, 0, 0, 0);
+		m_overlap_stack.emplace(output_start, output_start, output_start, 0, 0);
 		m_all_haplotypes = &all_haplotypes;
 		
 		// All haplotypes initially have the reference sequence.
@@ -352,16 +319,19 @@ namespace vcf2multialign {
 			auto const count(haplotype_vector.size());
 			haplotype_ptr_vector.resize(count);
 			for (size_t i(0); i < count; ++i)
+			{
+				haplotype_vector[i].current_pos = output_start;
 				haplotype_ptr_vector[i] = &haplotype_vector[i];
+			}
 		}
 	}
 	
 	
-	void sequence_writer::finish()
+	void sequence_writer_base::finish()
 	{
 		// Fill the remaining part with reference.
 		std::cerr << "Filling with the reference…" << std::endl;
-		auto const ref_size(m_reference->size());
+		auto const ref_size(std::min(m_output_end, m_reference->size()));
 		auto const output_end_pos(process_overlap_stack(ref_size));
 		
 		char const *ref_begin(m_reference->data());
@@ -369,8 +339,11 @@ namespace vcf2multialign {
 		{
 			for (auto &h : kv.second)
 			{
-				auto const output_len(ref_size - h.current_pos);
-				h.output_stream.write(ref_begin + h.current_pos, output_len);
+				if (h.current_pos < ref_size)
+				{
+					auto const output_len(ref_size - h.current_pos);
+					h.output_stream.write(ref_begin + h.current_pos, output_len);
+				}
 			}
 		}
 	}
@@ -0,0 +1,283 @@
+/*
+ Copyright (c) 2017 Tuukka Norri
+ This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <vcf2multialign/tabix_index.hh>
+#include <vcf2multialign/util.hh>
+
+
+namespace {
+
+	// Read little-endian values from the decompressed index.
+	class index_buffer
+	{
+	protected:
+		std::vector <char>	m_data;
+		std::size_t			m_pos{0};
+
+	public:
+		std::vector <char> &data() { return m_data; }
+
+		char const *read_bytes(std::size_t const len)
+		{
+			vcf2multialign::always_assert(len <= m_data.size() - m_pos, "Truncated index file");
+			char const *retval(m_data.data() + m_pos);
+			m_pos += len;
+			return retval;
+		}
+
+		template <typename t_int>
+		t_int read()
+		{
+			auto const *d(reinterpret_cast <unsigned char const *>(read_bytes(sizeof(t_int))));
+			typename std::make_unsigned <t_int>::type retval(0);
+			for (std::size_t i(0); i < sizeof(t_int); ++i)
+				retval |= decltype(retval)(d[i]) << (8 * i);
+			return retval;
+		}
+	};
+}
+
+
+namespace vcf2multialign {
+
+	bool tabix_index::open(char const *fname)
+	{
+		int const fd(::open(fname, O_RDONLY));
+		if (-1 == fd)
+			return false;
+
+		// Both TBI and CSI are BGZF compressed.
+		index_buffer buffer;
+		{
+			bgzf_reader reader;
+			reader.open(fd);
+
+			auto &data(buffer.data());
+			std::size_t len(0);
+			bool at_eof(false);
+			while (!at_eof)
+			{
+				data.resize(len + 65536);
+				len += reader.read(data.data() + len, 65536, at_eof);
+			}
+			data.resize(len);
+		}
+
+		char const *magic(buffer.read_bytes(4));
+		if (0 == memcmp(magic, "TBI\1", 4))
+		{
+			m_is_csi = false;
+			m_min_shift = 14;
+			m_depth = 5;
+		}
+		else if (0 == memcmp(magic, "CSI\1", 4))
+		{
+			m_is_csi = true;
+			m_min_shift = buffer.read <std::int32_t>();
+			m_depth = buffer.read <std::int32_t>();
+		}
+		else
+		{
+			fail("Unexpected index file format");
+		}
+
+		// The tabix header is stored as auxiliary data in CSI.
+		std::size_t aux_len(0);
+		if (m_is_csi)
+			aux_len = buffer.read <std::int32_t>();
+
+		std::int32_t ref_count(0);
+		if (m_is_csi)
+		{
+			char const *aux(buffer.read_bytes(aux_len));
+			if (28 <= aux_len)
+				read_sequence_names(aux, aux_len);
+			ref_count = buffer.read <std::int32_t>();
+		}
+		else
+		{
+			// n_ref, format, col_seq, col_beg, col_end, meta, skip, l_nm.
+			ref_count = buffer.read <std::int32_t>();
+			char const *header(buffer.read_bytes(7 * sizeof(std::int32_t)));
+			std::size_t const names_len(
+				std::uint32_t(header[24] & 0xff) |
+				(std::uint32_t(header[25] & 0xff) << 8) |
+				(std::uint32_t(header[26] & 0xff) << 16) |
+				(std::uint32_t(header[27] & 0xff) << 24)
+			);
+			char const *names(buffer.read_bytes(names_len));
+			read_sequence_names(names, names_len);
+		}
+
+		// Read the bins.
+		m_references.clear();
+		m_references.resize(ref_count);
+		for (auto &ref : m_references)
+		{
+			auto const bin_count(buffer.read <std::int32_t>());
+			for (std::int32_t i(0); i < bin_count; ++i)
+			{
+				auto const bin_no(buffer.read <std::uint32_t>());
+				auto &current_bin(ref.bins[bin_no]);
+				if (m_is_csi)
+					current_bin.loffset = buffer.read <std::uint64_t>();
+
+				auto const chunk_count(buffer.read <std::int32_t>());
+				current_bin.chunks.resize(chunk_count);
+				for (auto &current_chunk : current_bin.chunks)
+				{
+					current_chunk.beg = buffer.read <std::uint64_t>();
+					current_chunk.end = buffer.read <std::uint64_t>();
+				}
+			}
+
+			if (!m_is_csi)
+			{
+				auto const interval_count(buffer.read <std::int32_t>());
+				ref.linear_index.resize(interval_count);
+				for (auto &offset : ref.linear_index)
+					offset = buffer.read <std::uint64_t>();
+			}
+		}
+
+		return true;
+	}
+
+
+	// Read the sequence names from the tabix header that starts from format.
+	void tabix_index::read_sequence_names(char const *data, std::size_t const len)
+	{
+		m_reference_ids.clear();
+
+		// Skip format, col_seq, col_beg, col_end, meta, skip and l_nm when called with the CSI auxiliary data.
+		char const *names(data);
+		char const *names_end(data + len);
+		if (m_is_csi)
+			names += 7 * sizeof(std::int32_t);
+
+		std::size_t idx(0);
+		while (names < names_end)
+		{
+			auto const name_len(strnlen(names, names_end - names));
+			m_reference_ids.emplace(std::string(names, name_len), idx++);
+			names += 1 + name_len;
+		}
+	}
+
+
+	// List the bins that may contain records that overlap [beg, end), cf. reg2bins in SAMv1.
+	void tabix_index::list_bins(std::uint64_t const beg, std::uint64_t end, std::vector <std::uint32_t> &bins) const
+	{
+		// Positions beyond the largest bin are not indexed.
+		bins.clear();
+		end = std::min(end, std::uint64_t(1) << (m_min_shift + 3 * m_depth));
+		if (beg >= end)
+			return;
+
+		--end;
+		std::uint32_t level_start(0);
+		std::int32_t shift(m_min_shift + 3 * m_depth);
+		for (std::int32_t level(0); level <= m_depth; ++level)
+		{
+			auto const first(level_start + (beg >> shift));
+			auto const last(level_start + (end >> shift));
+			for (auto bin(first); bin <= last; ++bin)
+				bins.push_back(bin);
+
+			level_start += (1 << (3 * level));
+			shift -= 3;
+		}
+	}
+
+
+	// Find the smallest offset of the records that overlap the position beg.
+	auto tabix_index::min_offset(reference const &ref, std::uint64_t const beg) const -> virtual_offset_type
+	{
+		if (m_is_csi)
+		{
+			// Use the offset of the smallest bin that contains beg.
+			std::uint32_t level_start(((1 << (3 * m_depth)) - 1) / 7);
+			std::uint32_t bin_no(level_start + (beg >> m_min_shift));
+			while (true)
+			{
+				auto const it(ref.bins.find(bin_no));
+				if (ref.bins.cend() != it)
+					return it->second.loffset;
+
+				if (0 == bin_no)
+					return 0;
+
+				bin_no = (bin_no - 1) >> 3;
+			}
+		}
+		else
+		{
+			auto const &linear_index(ref.linear_index);
+			if (linear_index.empty())
+				return 0;
+
+			auto const idx(beg >> m_min_shift);
+			return (idx < linear_index.size() ? linear_index[idx] : linear_index.back());
+		}
+	}
+
+
+	bool tabix_index::find_first_offset(
+		std::string const &seq_name,
+		std::uint64_t const beg,
+		std::uint64_t const end,
+		virtual_offset_type &offset
+	) const
+	{
+		auto const id_it(m_reference_ids.find(seq_name));
+		if (m_reference_ids.cend() == id_it)
+			return false;
+
+		return find_first_offset(id_it->second, beg, end, offset);
+	}
+
+
+	bool tabix_index::find_first_offset(
+		std::size_t const seq_idx,
+		std::uint64_t const beg,
+		std::uint64_t const end,
+		virtual_offset_type &offset
+	) const
+	{
+		if (! (seq_idx < m_references.size()))
+			return false;
+
+		auto const &ref(m_references[seq_idx]);
+		auto const min_offset(this->min_offset(ref, beg));
+
+		std::vector <std::uint32_t> bins;
+		list_bins(beg, end, bins);
+
+		bool found(false);
+		offset = std::numeric_limits <virtual_offset_type>::max();
+		for (auto const bin_no : bins)
+		{
+			auto const it(ref.bins.find(bin_no));
+			if (ref.bins.cend() == it)
+				continue;
+
+			for (auto const &current_chunk : it->second.chunks)
+			{
+				// Skip the chunks that end before the first record that may overlap the range.
+				if (current_chunk.end <= min_offset)
+					continue;
+
+				found = true;
+				offset = std::min(offset, std::max(current_chunk.beg, min_offset));
+			}
+		}
+
+		return found;
+	}
+}
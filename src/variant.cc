@@ -16,29 +16,119 @@ namespace vcf2multialign {
 	}
 	
 	
+	void variant_base::reserve_samples(std::size_t const count)
+	{
+		m_gt_codes.resize(count * m_ploidy_stride, ABSENT_GENOTYPE_CODE);
+		m_phase_mask.resize((count * m_ploidy_stride + 63) / 64, 0);
+		m_ploidies.resize(count, 0);
+	}
+	
+	
+	// Change the number of slots per sample, moving the parsed samples.
+	void variant_base::set_ploidy_stride(std::size_t const stride)
+	{
+		if (stride == m_ploidy_stride)
+			return;
+		
+		std::vector <genotype_code> gt_codes(m_ploidies.size() * stride, ABSENT_GENOTYPE_CODE);
+		std::vector <uint64_t> phase_mask((m_ploidies.size() * stride + 63) / 64, 0);
+		for (std::size_t i(0); i < m_sample_count; ++i)
+		{
+			auto const ploidy(m_ploidies[i]);
+			for (std::size_t j(0); j < ploidy; ++j)
+			{
+				auto const src_slot(i * m_ploidy_stride + j);
+				auto const dst_slot(i * stride + j);
+				gt_codes[dst_slot] = m_gt_codes[src_slot];
+				phase_mask[dst_slot / 64] |= ((m_phase_mask[src_slot / 64] >> (src_slot % 64)) & 0x1) << (dst_slot % 64);
+			}
+		}
+		
+		using std::swap;
+		swap(m_gt_codes, gt_codes);
+		swap(m_phase_mask, phase_mask);
+		m_ploidy_stride = stride;
+	}
+	
+	
 	void variant_base::set_gt(std::size_t const alt, std::size_t const sample_no, std::size_t const idx, bool const is_phased)
 	{
-		// Check that the samples are given in consecutive order.
+		// Check that the samples are given in increasing order.
 		always_assert(0 != sample_no);
-		always_assert(sample_no == 1 || sample_no == m_sample_count - 1 || sample_no == m_sample_count);
-		m_sample_count = 1 + sample_no;
+		always_assert(m_sample_count <= 1 + sample_no);
+		
+		if (! (sample_no < m_ploidies.size()))
+			reserve_samples(1 + sample_no);
 		
-		if (! (m_sample_count <= m_samples.size()))
-			m_samples.resize(m_sample_count);
+		// Clear the samples that were skipped.
+		for (std::size_t i(m_sample_count); i < sample_no; ++i)
+			clear_sample(i);
 		
-		auto &sample(m_samples[sample_no]);
+		m_sample_count = 1 + sample_no;
 		
 		// Again check the order.
-		always_assert(0 == idx || idx == sample.m_gt_count);
-		sample.m_gt_count = 1 + idx;
+		always_assert(0 == idx || idx == m_ploidies[sample_no]);
 		
-		if (! (sample.m_gt_count <= sample.m_genotype.size()))
-			sample.m_genotype.resize(sample.m_gt_count);
+		// Make room for samples with higher ploidy than the previous ones.
+		if (m_ploidy_stride <= idx)
+			set_ploidy_stride(1 + idx);
 		
-		auto &gt(sample.m_genotype[idx]);
+		set_genotype_code(alt, sample_no, idx);
+		set_phase_bit(sample_no * m_ploidy_stride + idx, is_phased);
+		
+		if (0 != idx && !is_phased)
+			m_is_phased = false;
+		
+		if (alt)
+			m_carriers.push_back(genotype_carrier{sample_no, alt, uint8_t(idx)});
+	}
+	
+	
+	void variant_base::prepare_samples(std::size_t const last_sample_no, std::size_t const min_ploidy_stride)
+	{
+		always_assert(m_sample_count <= 1 + last_sample_no);
+		
+		if (m_ploidy_stride < min_ploidy_stride)
+			set_ploidy_stride(min_ploidy_stride);
+		
+		if (m_ploidies.size() <= last_sample_no)
+			reserve_samples(1 + last_sample_no);
+		
+		for (std::size_t i(m_sample_count); i <= last_sample_no; ++i)
+			clear_sample(i);
+		
+		m_sample_count = 1 + last_sample_no;
+	}
+	
+	
+	void variant_base::copy_genotypes(variant_base const &other, std::size_t const sample_offset)
+	{
+		always_assert(other.m_sample_count <= 1 || sample_offset + other.m_sample_count <= m_sample_count);
+		always_assert(other.m_ploidy_stride <= m_ploidy_stride);
 		
-		gt.alt = alt;
-		gt.is_phased = is_phased;
+		for (std::size_t i(1); i < other.m_sample_count; ++i)
+		{
+			auto const sample_no(sample_offset + i);
+			auto const ploidy(other.m_ploidies[i]);
+			clear_sample(sample_no);
+			m_ploidies[sample_no] = ploidy;
+			
+			auto const src_begin(other.m_gt_codes.begin() + i * other.m_ploidy_stride);
+			std::copy(src_begin, src_begin + ploidy, m_gt_codes.begin() + sample_no * m_ploidy_stride);
+			
+			for (std::size_t j(0); j < ploidy; ++j)
+			{
+				auto const src_slot(i * other.m_ploidy_stride + j);
+				set_phase_bit(sample_no * m_ploidy_stride + j, (other.m_phase_mask[src_slot / 64] >> (src_slot % 64)) & 0x1);
+			}
+		}
+	}
+	
+	
+	void variant_base::add_carriers(std::vector <genotype_carrier> const &carriers, bool const is_phased)
+	{
+		m_carriers.insert(m_carriers.end(), carriers.begin(), carriers.end());
+		m_is_phased &= is_phased;
 	}
 	
 	
@@ -61,6 +151,48 @@ namespace vcf2multialign {
 	
 	
 	void variant::reset()
+	{
+		superclass::reset();
+		std::string_view empty(nullptr, 0);
+		m_chrom_id = empty;
+		m_ref = empty;
+		m_slab.reset();
+	}
+	
+	
+	std::size_t variant::string_length(transient_variant const &var)
+	{
+		auto retval(var.chrom_id().size() + var.ref().size());
+		for (auto const &alt : var.alts())
+			retval += alt.size();
+		for (auto const &id : var.ids())
+			retval += id.size();
+		return retval;
+	}
+	
+	
+	void variant::assign(transient_variant const &other, variant_slab_ptr const &slab)
+	{
+		assert(string_length(other) <= slab->available());
+		
+		variant_base::operator=(other);
+		m_slab = slab;
+		m_chrom_id = m_slab->append(other.chrom_id());
+		m_ref = m_slab->append(other.ref());
+		
+		auto const &alts(other.alts());
+		m_alts.resize(alts.size());
+		for (std::size_t i(0); i < alts.size(); ++i)
+			m_alts[i] = m_slab->append(alts[i]);
+		
+		auto const &ids(other.ids());
+		m_id.resize(ids.size());
+		for (std::size_t i(0); i < ids.size(); ++i)
+			m_id[i] = m_slab->append(ids[i]);
+	}
+	
+	
+	void persistent_variant::reset()
 	{
 		superclass::reset();
 		m_chrom_id.clear();
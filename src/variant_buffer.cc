@@ -3,115 +3,237 @@
  * This code is licensed under MIT license (see LICENSE for details).
  */
 
+#include <algorithm>
+#include <iostream>
 #include <vcf2multialign/util.hh>
 #include <vcf2multialign/variant_buffer.hh>
 
 
 namespace vcf2multialign {
 
-	void variant_buffer::return_node_to_buffer(variant_set::node_type &&node)
+	// Estimate the memory used by the variant for flow control.
+	std::size_t variant_buffer::variant_size(variant const &var)
 	{
-		std::lock_guard <std::mutex> guard(m_buffer_mutex);
-		m_d.m_buffer.emplace_back(std::move(node));
+		std::size_t retval(
+			sizeof(variant) +
+			var.chrom_id().size() + var.ref().size() +
+			var.sample_count() * (1 + var.ploidy_stride() * sizeof(genotype_code)) +
+			var.carriers().size() * sizeof(genotype_carrier)
+		);
+
+		for (auto const &alt : var.alts())
+			retval += sizeof(alt) + alt.size();
+
+		return retval;
 	}
-	
-	
-	bool variant_buffer::get_node_from_buffer(variant_set::node_type &node)
+
+
+	bool variant_buffer::can_get_empty_batch() const
+	{
+		auto const &handoff(*m_d.m_handoff);
+		return
+			handoff.bytes_in_flight.load() < MAX_BYTES_IN_FLIGHT &&
+			(m_d.m_allocated_batches < BATCH_COUNT || !handoff.empty_batches.empty());
+	}
+
+
+	void variant_buffer::get_empty_batch()
 	{
-		std::lock_guard <std::mutex> guard(m_buffer_mutex);
-		auto const bufsize(m_d.m_buffer.size());
-		if (bufsize)
+		auto &handoff(*m_d.m_handoff);
+		while (true)
 		{
-			using std::swap;
-			swap(node, m_d.m_buffer[bufsize - 1]);
-			m_d.m_buffer.pop_back();
-			return true;
+			if (can_get_empty_batch())
+			{
+				if (handoff.empty_batches.pop(m_d.m_current_batch))
+				{
+					// Take the nodes returned by the main queue.
+					auto &nodes(m_d.m_current_batch->processed_nodes);
+					std::move(nodes.begin(), nodes.end(), std::back_inserter(m_d.m_free_nodes));
+					nodes.clear();
+					return;
+				}
+
+				++m_d.m_allocated_batches;
+				m_d.m_current_batch.reset(new batch);
+				return;
+			}
+
+			// Wait for the main queue to process the batches in flight.
+			// Check the condition again after setting the flag so that the signal is not missed.
+			handoff.producer_is_waiting.store(true);
+			if (can_get_empty_batch() && handoff.producer_is_waiting.exchange(false))
+				continue;
+
+			++handoff.producer_wait_count;
+			auto const st(dispatch_semaphore_wait(*handoff.producer_sema, DISPATCH_TIME_FOREVER));
+			always_assert(0 == st, "dispatch_semaphore_wait returned early");
 		}
-		return false;
 	}
-	
-	
+
+
+	// Called when a variant with a new POS is found or the input ends.
+	void variant_buffer::close_group()
+	{
+		auto &batch(*m_d.m_current_batch);
+		if (! (batch.group_count < batch.groups.size() && !batch.groups[batch.group_count].empty()))
+			return;
+
+		++batch.group_count;
+		if (BATCH_SIZE <= batch.byte_count)
+			pass_batch();
+	}
+
+
+	void variant_buffer::pass_batch()
+	{
+		auto &handoff(*m_d.m_handoff);
+		auto const byte_count(m_d.m_current_batch->byte_count);
+		auto const bytes_in_flight(byte_count + handoff.bytes_in_flight.fetch_add(byte_count));
+		always_assert(handoff.filled_batches.push(std::move(m_d.m_current_batch)), "Unable to pass a batch");
+
+		++handoff.batch_count;
+		handoff.max_batches_in_flight = std::max(handoff.max_batches_in_flight, handoff.filled_batches.size());
+		handoff.max_bytes_in_flight = std::max(handoff.max_bytes_in_flight, bytes_in_flight);
+
+		// Start processing unless the main queue is already doing so.
+		if (!handoff.consumer_is_scheduled.exchange(true))
+			dispatch_async_f <variant_buffer, &variant_buffer::process_batches>(*m_d.m_main_queue, this);
+
+		get_empty_batch();
+	}
+
+
 	void variant_buffer::read_input()
 	{
+		auto &handoff(*m_d.m_handoff);
+		handoff.batch_count = 0;
+		handoff.producer_wait_count = 0;
+		handoff.max_batches_in_flight = 0;
+		handoff.max_bytes_in_flight = 0;
+		handoff.consumer_idle_count = 0;
+
 		m_d.m_previous_pos = 0;
-		
+		if (!m_d.m_current_batch)
+			get_empty_batch();
+
 		bool should_continue(false);
 		do
 		{
 			// Read from the stream.
 			m_d.m_reader->fill_buffer();
-			
+
 			should_continue = m_d.m_reader->parse([this](transient_variant const &transient_variant) -> bool {
-				
-				using std::swap;
-				
+
 				// Get a node handle.
-				variant_set::node_type node;	// Empty, insert does nothing.
-				if (! get_node_from_buffer(node))
+				variant_set::node_type node;
+				if (m_d.m_free_nodes.empty())
 				{
 					// No handles in the buffer, create a new one and retrieve it.
 					node = m_d.m_factory.extract(m_d.m_factory.emplace());
 				}
-				
-				// Copy the variant to node.
-				node.value() = transient_variant;
-				
+				else
+				{
+					node = std::move(m_d.m_free_nodes.back());
+					m_d.m_free_nodes.pop_back();
+				}
+
+				// Copy the variant to node. The strings are copied to the current slab
+				// so that they remain valid after the reader's buffer has been refilled.
+				auto const string_length(variant::string_length(transient_variant));
+				if (! (m_d.m_current_slab && string_length <= m_d.m_current_slab->available()))
+					m_d.m_current_slab = m_d.m_slab_pool->get_slab(string_length);
+				node.value().assign(transient_variant, m_d.m_current_slab);
+
 				// Check if the variant has a new POS value.
 				auto const variant_pos(node.value().pos());
 				if (variant_pos != m_d.m_previous_pos)
 				{
 					m_d.m_previous_pos = variant_pos;
-					variant_set prepared_variants;
-					swap(m_d.m_prepared_variants, prepared_variants);
-		
-					auto fn = [this, pr = std::move(prepared_variants)]() mutable {
-						process_input(pr);
-					};
-					dispatch_async_fn(*m_d.m_main_queue, std::move(fn));
-					
-					// Wait for our turn to continue.
-					// Do this only after the main thread has received something to process so that
-					// a long span of variants with the same POS don't cause a deadlock.
-					auto const st(dispatch_semaphore_wait(*m_d.m_process_sema, DISPATCH_TIME_FOREVER));
-					always_assert(0 == st, "dispatch_semaphore_wait returned early");
+					close_group();
 				}
-				
-				// Add the node to the input list.
-				m_d.m_prepared_variants.insert(std::move(node));
-				
+
+				// Add the node to the current group.
+				auto &batch(*m_d.m_current_batch);
+				if (batch.groups.size() == batch.group_count)
+					batch.groups.emplace_back();
+
+				batch.byte_count += variant_size(node.value());
+				batch.groups[batch.group_count].insert(std::move(node));
+
 				return true;
 			});
 		} while (should_continue);
 
-		if (!m_d.m_prepared_variants.empty())
+		m_d.m_current_slab.reset();
+
+		// Pass the remaining variants.
+		close_group();
+		if (m_d.m_current_batch->group_count)
+			pass_batch();
+
+		dispatch_async_f <variant_buffer, &variant_buffer::finish>(*m_d.m_main_queue, this);
+	}
+
+
+	void variant_buffer::process_batch(batch &batch)
+	{
+		for (std::size_t i(0); i < batch.group_count; ++i)
 		{
-			using std::swap;
-			variant_set prepared_variants;
-			swap(m_d.m_prepared_variants, prepared_variants);
-			auto fn = [this, pr = std::move(prepared_variants)]() mutable {
-				process_input(pr);
-			};
-			dispatch_async_fn(*m_d.m_main_queue, std::move(fn));
+			auto &variants(batch.groups[i]);
+			while (!variants.empty())
+			{
+				auto node(variants.extract(variants.cbegin()));
+				auto &value(node.value());
+
+				// Process the input.
+				m_d.m_delegate->handle_variant(value);
+
+				// Release the slab and return the node.
+				value.reset();
+				batch.processed_nodes.emplace_back(std::move(node));
+			}
 		}
-		
-		dispatch_async_f <variant_buffer_delegate, &variant_buffer_delegate::finish>(*m_d.m_main_queue, m_d.m_delegate);
+
+		batch.group_count = 0;
+		batch.byte_count = 0;
 	}
-	
-	
-	void variant_buffer::process_input(variant_set &variants)
+
+
+	void variant_buffer::process_batches()
 	{
-		while (!variants.empty())
+		auto &handoff(*m_d.m_handoff);
+		while (true)
 		{
-			auto node(variants.extract(variants.cbegin()));
-			auto &value(node.value());
-	
-			// Process the input.
-			m_d.m_delegate->handle_variant(value);
-	
-			// Return the node.
-			return_node_to_buffer(std::move(node));
-	
-			dispatch_semaphore_signal(*m_d.m_process_sema);
+			batch_ptr batch;
+			while (handoff.filled_batches.pop(batch))
+			{
+				auto const byte_count(batch->byte_count);
+				process_batch(*batch);
+				always_assert(handoff.empty_batches.push(std::move(batch)), "Unable to return a batch");
+				handoff.bytes_in_flight.fetch_sub(byte_count);
+
+				if (handoff.producer_is_waiting.exchange(false))
+					dispatch_semaphore_signal(*handoff.producer_sema);
+			}
+
+			// Stop unless a batch was passed after the ring was found empty.
+			++handoff.consumer_idle_count;
+			handoff.consumer_is_scheduled.store(false);
+			if (handoff.filled_batches.empty() || handoff.consumer_is_scheduled.exchange(true))
+				return;
 		}
 	}
+
+
+	void variant_buffer::finish()
+	{
+		auto const &handoff(*m_d.m_handoff);
+		std::cerr
+		<< "Passed " << handoff.batch_count << " batches of variants to the handler; "
+		<< "the parser waited " << handoff.producer_wait_count << " times and the handler "
+		<< handoff.consumer_idle_count << " times. At most " << handoff.max_batches_in_flight
+		<< " batches and " << (handoff.max_bytes_in_flight / 1024) << " KiB were in flight." << std::endl;
+
+		m_d.m_delegate->finish();
+	}
 }
@@ -0,0 +1,367 @@
+/*
+ Copyright (c) 2017 Tuukka Norri
+ This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vcf2multialign/structural_index.hh>
+#include <vcf2multialign/util.hh>
+#include <vcf2multialign/variant.hh>
+#include <vcf2multialign/vcf_input.hh>
+
+
+namespace vcf2multialign {
+
+	void vcf_buffered_input::set_preferred_buffer_size(std::size_t const size)
+	{
+		always_assert(!m_is_reading, "Buffer size should be set before reading");
+		m_chunk_size = std::max(m_chunk_size, size);
+	}
+
+
+	void vcf_buffered_input::set_read_ahead_buffer_count(std::size_t const count)
+	{
+		always_assert(!m_is_reading, "Buffer count should be set before reading");
+
+		// One more chunk is needed for the range being parsed.
+		m_chunks.resize(1 + std::max <std::size_t>(1, count));
+	}
+
+
+	// Fill the chunks in order until the end of the input has been reached or stop_reading() is called.
+	void vcf_buffered_input::read_chunks(void *ctx)
+	{
+		auto &self(*static_cast <vcf_buffered_input *>(ctx));
+		std::size_t idx(0);
+		while (true)
+		{
+			{
+				std::unique_lock <std::mutex> lock(self.m_mutex);
+				self.m_cv.wait(lock, [&self](){ return self.m_should_stop || 0 < self.m_free_count; });
+				if (self.m_should_stop)
+					return;
+
+				--self.m_free_count;
+			}
+
+			auto &chunk(self.m_chunks[idx]);
+			char *dst(chunk.data.data() + chunk.prefix_size);
+			std::size_t const space(chunk.data.size() - chunk.prefix_size);
+			chunk.size = 0;
+			chunk.at_eof = false;
+			while (chunk.size < space && !chunk.at_eof)
+				chunk.size += self.read(dst + chunk.size, space - chunk.size, chunk.at_eof);
+
+			{
+				std::lock_guard <std::mutex> lock(self.m_mutex);
+				++self.m_filled_count;
+			}
+			self.m_cv.notify_all();
+
+			if (chunk.at_eof)
+				return;
+
+			idx = (1 + idx) % self.m_chunks.size();
+		}
+	}
+
+
+	void vcf_buffered_input::start_reading()
+	{
+		for (auto &chunk : m_chunks)
+		{
+			if (chunk.data.size() < m_prefix_size + m_chunk_size)
+				chunk.data.resize(m_prefix_size + m_chunk_size);
+			chunk.prefix_size = m_prefix_size;
+		}
+
+		m_remainder = nullptr;
+		m_remainder_size = 0;
+		m_remainder_is_in_long_line_buffer = false;
+		m_current_chunk = SIZE_MAX;
+		m_next_chunk = 0;
+		m_filled_count = 0;
+		m_free_count = m_chunks.size();
+		m_should_stop = false;
+		m_is_reading = true;
+
+		dispatch_group_async_f(*m_read_group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), this, &read_chunks);
+	}
+
+
+	void vcf_buffered_input::stop_reading()
+	{
+		if (!m_is_reading)
+			return;
+
+		{
+			std::lock_guard <std::mutex> lock(m_mutex);
+			m_should_stop = true;
+		}
+		m_cv.notify_all();
+
+		dispatch_group_wait(*m_read_group, DISPATCH_TIME_FOREVER);
+		m_is_reading = false;
+	}
+
+
+	auto vcf_buffered_input::wait_for_chunk() -> chunk &
+	{
+		{
+			std::unique_lock <std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this](){ return 0 < m_filled_count; });
+			--m_filled_count;
+		}
+
+		auto &retval(m_chunks[m_next_chunk]);
+		m_next_chunk = (1 + m_next_chunk) % m_chunks.size();
+		return retval;
+	}
+
+
+	void vcf_buffered_input::release_chunk(std::size_t const idx)
+	{
+		// Reserve more space for long lines if needed. The reading thread
+		// does not access the chunk before it has been released.
+		auto &chunk(m_chunks[idx]);
+		if (chunk.prefix_size < m_prefix_size)
+		{
+			chunk.data.resize(m_prefix_size + m_chunk_size);
+			chunk.prefix_size = m_prefix_size;
+		}
+
+		{
+			std::lock_guard <std::mutex> lock(m_mutex);
+			++m_free_count;
+		}
+		m_cv.notify_all();
+	}
+
+
+	void vcf_buffered_input::move_remainder_to_long_line_buffer()
+	{
+		if (m_remainder_is_in_long_line_buffer)
+			return;
+
+		m_long_line_buffer.assign(m_remainder, m_remainder + m_remainder_size);
+		m_remainder_is_in_long_line_buffer = true;
+	}
+
+
+	void vcf_buffered_input::fill_buffer(vcf_input_range &range)
+	{
+		if (m_reached_eof)
+		{
+			range = vcf_input_range();
+			return;
+		}
+
+		if (!m_is_reading)
+			start_reading();
+
+		while (true)
+		{
+			auto const idx(m_next_chunk);
+			auto &chunk(wait_for_chunk());
+			char *data(chunk.data.data() + chunk.prefix_size);
+			char *data_end(data + chunk.size);
+
+			// Find the end of the last complete line in the new data.
+			char *lines_end(data_end);
+			if (!chunk.at_eof)
+			{
+				structural_index index(data, data_end);
+				auto const nl(index.find_last_newline());
+				if (!nl)
+				{
+					// The chunk contains a part of a long line; collect it and continue with the next chunk.
+					move_remainder_to_long_line_buffer();
+					m_long_line_buffer.insert(m_long_line_buffer.end(), data, data_end);
+					m_remainder = m_long_line_buffer.data();
+					m_remainder_size = m_long_line_buffer.size();
+
+					if (SIZE_MAX != m_current_chunk)
+						release_chunk(m_current_chunk);
+					m_current_chunk = SIZE_MAX;
+					release_chunk(idx);
+					continue;
+				}
+
+				lines_end = data + (nl - data) + 1;
+			}
+
+			if (m_remainder_size <= chunk.prefix_size)
+			{
+				// Copy the incomplete line of the previous range in front of the new data.
+				data -= m_remainder_size;
+				std::copy(m_remainder, m_remainder + m_remainder_size, data);
+				range.p = data;
+				range.pe = lines_end;
+			}
+			else
+			{
+				// Combine the lines in a separate buffer and reserve more space in the chunks for the following lines.
+				move_remainder_to_long_line_buffer();
+				m_long_line_buffer.insert(m_long_line_buffer.end(), data, lines_end);
+				range.p = m_long_line_buffer.data();
+				range.pe = range.p + m_long_line_buffer.size();
+				m_prefix_size = std::max(m_prefix_size, 2 * m_remainder_size);
+			}
+
+			// The previous chunk is no longer needed.
+			if (SIZE_MAX != m_current_chunk)
+				release_chunk(m_current_chunk);
+
+			m_current_chunk = idx;
+			m_remainder = lines_end;
+			m_remainder_size = data_end - lines_end;
+			m_remainder_is_in_long_line_buffer = false;
+
+			if (chunk.at_eof)
+			{
+				m_reached_eof = true;
+				range.eof = range.pe;
+			}
+			else
+			{
+				range.eof = nullptr;
+			}
+
+			return;
+		}
+	}
+
+
+	std::size_t vcf_stream_input::read(char *dst, std::size_t const len, bool &at_eof)
+	{
+		m_stream->read(dst, len);
+		at_eof = m_stream->eof();
+		return m_stream->gcount();
+	}
+
+
+	bool vcf_stream_input::getline(std::string &dst)
+	{
+		return bool(std::getline(*m_stream, dst));
+	}
+
+
+	void vcf_stream_input::store_first_variant_offset()
+	{
+		m_first_variant_offset = m_stream->tellg();
+	}
+
+
+	// Seek to the beginning of the records.
+	void vcf_stream_input::reset_to_first_variant_offset()
+	{
+		reset_buffer();
+		m_stream->clear();
+		m_stream->seekg(m_first_variant_offset);
+	}
+
+
+	bool vcf_stream_input::tell(std::uint64_t &offset)
+	{
+		// Pipes do not have offsets.
+		auto const pos(m_stream->tellg());
+		if (-1 == pos)
+			return false;
+
+		offset = pos;
+		return true;
+	}
+
+
+	void vcf_bgzf_input::reset_to_first_variant_offset()
+	{
+		reset_buffer();
+		m_reader.seek(m_first_variant_offset);
+	}
+
+
+	vcf_mmap_input::~vcf_mmap_input()
+	{
+		if (m_data)
+			munmap(const_cast <char *>(m_data), m_size);
+	}
+
+
+	bool vcf_mmap_input::open(int const fd)
+	{
+		struct stat sb;
+		if (0 != fstat(fd, &sb))
+			return false;
+
+		// Empty files and e.g. pipes cannot be mapped.
+		if (! (S_ISREG(sb.st_mode) && 0 < sb.st_size))
+			return false;
+
+		void *data(mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+		if (MAP_FAILED == data)
+			return false;
+
+		// The file is read from the beginning to the end in each pass.
+		madvise(data, sb.st_size, MADV_SEQUENTIAL);
+
+		m_data = static_cast <char const *>(data);
+		m_size = sb.st_size;
+		m_pos = 0;
+		return true;
+	}
+
+
+	bool vcf_mmap_input::getline(std::string &dst)
+	{
+		if (m_pos == m_size)
+			return false;
+
+		std::string_view sv(m_data + m_pos, m_size - m_pos);
+		auto const nl_pos(sv.find('\n'));
+		if (std::string_view::npos == nl_pos)
+		{
+			dst.assign(sv.cbegin(), sv.cend());
+			m_pos = m_size;
+		}
+		else
+		{
+			dst.assign(sv.data(), nl_pos);
+			m_pos += 1 + nl_pos;
+		}
+		return true;
+	}
+
+
+	void vcf_mmap_input::store_first_variant_offset()
+	{
+		m_first_variant_offset = m_pos;
+	}
+
+
+	void vcf_mmap_input::reset_to_first_variant_offset()
+	{
+		m_pos = m_first_variant_offset;
+	}
+
+
+	bool vcf_mmap_input::set_first_variant_offset(std::uint64_t const offset)
+	{
+		if (m_size < offset)
+			return false;
+
+		m_first_variant_offset = offset;
+		return true;
+	}
+
+
+	void vcf_mmap_input::fill_buffer(vcf_input_range &range)
+	{
+		// Pass the whole remaining file to the parser. Subsequent calls produce an empty range.
+		range.p = m_data + m_pos;
+		range.pe = m_data + m_size;
+		range.eof = range.pe;
+		m_pos = m_size;
+	}
+}
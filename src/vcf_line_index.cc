@@ -0,0 +1,244 @@
+/*
+ Copyright (c) 2017 Tuukka Norri
+ This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string_view>
+#include <sys/stat.h>
+#include <vcf2multialign/vcf_line_index.hh>
+
+
+namespace {
+
+	char const s_magic[8]{'V', '2', 'M', 'L', 'I', 'D', 'X', '\1'};
+
+
+	void append_u64(std::string &dst, std::uint64_t const val)
+	{
+		for (std::size_t i(0); i < 8; ++i)
+			dst.push_back(char((val >> (8 * i)) & 0xff));
+	}
+
+
+	// Read little-endian values, failing on truncated input.
+	class index_buffer
+	{
+	protected:
+		std::string		m_data;
+		std::size_t		m_pos{0};
+		bool			m_is_valid{true};
+
+	public:
+		std::string &data() { return m_data; }
+		bool is_valid() const { return m_is_valid; }
+		std::size_t remaining() const { return m_data.size() - m_pos; }
+
+		char const *read_bytes(std::size_t const len)
+		{
+			if (! (m_is_valid && len <= m_data.size() - m_pos))
+			{
+				m_is_valid = false;
+				return nullptr;
+			}
+
+			char const *retval(m_data.data() + m_pos);
+			m_pos += len;
+			return retval;
+		}
+
+		std::uint64_t read_u64()
+		{
+			auto const *d(reinterpret_cast <unsigned char const *>(read_bytes(8)));
+			if (!d)
+				return 0;
+
+			std::uint64_t retval(0);
+			for (std::size_t i(0); i < 8; ++i)
+				retval |= std::uint64_t(d[i]) << (8 * i);
+			return retval;
+		}
+	};
+}
+
+
+namespace vcf2multialign {
+
+	bool vcf_line_index::read_file_stats(char const *variants_fname)
+	{
+		struct stat sb;
+		if (0 != stat(variants_fname, &sb))
+			return false;
+
+		m_file_size = sb.st_size;
+		m_file_mtime = sb.st_mtime;
+		return true;
+	}
+
+
+	bool vcf_line_index::build(char const *variants_fname, vcf_input &input, std::size_t const last_header_lineno, std::size_t const interval)
+	{
+		m_chrom_names.clear();
+		m_entries.clear();
+
+		if (!read_file_stats(variants_fname))
+			return false;
+
+		std::string line;
+		std::size_t lineno(last_header_lineno);
+		std::size_t lines_since_entry(interval);
+		std::uint64_t offset(0);
+		while (true)
+		{
+			if (!input.tell(offset))
+				return false;
+
+			if (!input.getline(line))
+				break;
+
+			++lineno;
+			auto const tab_pos(line.find('\t'));
+			if (std::string::npos == tab_pos)
+				continue;
+
+			// Add an entry for the first line of each chromosome so that regions may be found.
+			std::string_view const chrom(line.data(), tab_pos);
+			bool const is_new_chrom(m_chrom_names.empty() || m_chrom_names.back() != chrom);
+			if (is_new_chrom || interval <= lines_since_entry)
+			{
+				if (is_new_chrom)
+					m_chrom_names.emplace_back(chrom);
+
+				entry e;
+				e.offset = offset;
+				e.lineno = lineno;
+				e.pos = strtoull(line.c_str() + tab_pos + 1, nullptr, 10);
+				e.chrom_idx = m_chrom_names.size() - 1;
+				m_entries.push_back(e);
+				lines_since_entry = 0;
+			}
+
+			++lines_since_entry;
+		}
+
+		return true;
+	}
+
+
+	bool vcf_line_index::read(char const *variants_fname)
+	{
+		std::ifstream stream(index_fname(variants_fname), std::ios::binary);
+		if (!stream)
+			return false;
+
+		index_buffer buffer;
+		buffer.data().assign(std::istreambuf_iterator <char>(stream), std::istreambuf_iterator <char>());
+
+		// Rebuild the index if the variant file has been modified.
+		{
+			vcf_line_index current;
+			if (!current.read_file_stats(variants_fname))
+				return false;
+
+			char const *magic(buffer.read_bytes(sizeof(s_magic)));
+			if (! (magic && 0 == memcmp(magic, s_magic, sizeof(s_magic))))
+				return false;
+
+			m_file_size = buffer.read_u64();
+			m_file_mtime = buffer.read_u64();
+			if (! (m_file_size == current.m_file_size && m_file_mtime == current.m_file_mtime))
+				return false;
+		}
+
+		// Check the counts against the remaining data before allocating.
+		auto const chrom_count(buffer.read_u64());
+		if (! (buffer.is_valid() && chrom_count <= buffer.remaining() / 8))
+			return false;
+
+		m_chrom_names.resize(chrom_count);
+		for (auto &name : m_chrom_names)
+		{
+			auto const len(buffer.read_u64());
+			auto const *data(buffer.read_bytes(len));
+			if (!data)
+				return false;
+			name.assign(data, len);
+		}
+
+		auto const entry_count(buffer.read_u64());
+		if (! (buffer.is_valid() && entry_count <= buffer.remaining() / 32))
+			return false;
+
+		m_entries.resize(entry_count);
+		for (auto &e : m_entries)
+		{
+			e.offset = buffer.read_u64();
+			e.lineno = buffer.read_u64();
+			e.pos = buffer.read_u64();
+			e.chrom_idx = buffer.read_u64();
+		}
+
+		return buffer.is_valid();
+	}
+
+
+	bool vcf_line_index::write(char const *variants_fname) const
+	{
+		std::string data(s_magic, sizeof(s_magic));
+		append_u64(data, m_file_size);
+		append_u64(data, m_file_mtime);
+
+		append_u64(data, m_chrom_names.size());
+		for (auto const &name : m_chrom_names)
+		{
+			append_u64(data, name.size());
+			data += name;
+		}
+
+		append_u64(data, m_entries.size());
+		for (auto const &e : m_entries)
+		{
+			append_u64(data, e.offset);
+			append_u64(data, e.lineno);
+			append_u64(data, e.pos);
+			append_u64(data, e.chrom_idx);
+		}
+
+		std::ofstream stream(index_fname(variants_fname), std::ios::binary | std::ios::trunc);
+		stream.write(data.data(), data.size());
+		return bool(stream);
+	}
+
+
+	bool vcf_line_index::find_region_start(vcf_region const &region, entry &dst) const
+	{
+		auto const it(std::find(m_chrom_names.cbegin(), m_chrom_names.cend(), region.chrom_id));
+		if (m_chrom_names.cend() == it)
+			return false;
+
+		// Start from the first line of the chromosome or from the last sampled line before the region.
+		std::uint32_t const chrom_idx(std::distance(m_chrom_names.cbegin(), it));
+		bool found(false);
+		for (auto const &e : m_entries)
+		{
+			if (e.chrom_idx != chrom_idx)
+			{
+				if (found)
+					break;
+				continue;
+			}
+
+			if (found && region.first_pos <= e.pos)
+				break;
+
+			dst = e;
+			found = true;
+		}
+
+		return found;
+	}
+}
@@ -0,0 +1,245 @@
+/*
+ Copyright (c) 2017 Tuukka Norri
+ This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <dispatch/dispatch.h>
+#include <iostream>
+#include <vcf2multialign/util.hh>
+#include <vcf2multialign/vcf_merging_reader.hh>
+
+
+namespace vcf2multialign {
+
+	void vcf_merging_reader::add_partition(std::unique_ptr <vcf_reader> &&reader)
+	{
+		auto &part(m_partitions.emplace_back());
+		part.reader = std::move(reader);
+	}
+
+
+	void vcf_merging_reader::read_header()
+	{
+		always_assert(!m_partitions.empty(), "No variant files given");
+
+		// Number the samples in the order of the partitions.
+		std::size_t sample_offset(0);
+		for (auto &part : m_partitions)
+		{
+			part.reader->read_header();
+			part.sample_offset = sample_offset;
+			for (auto const &kv : part.reader->sample_names())
+			{
+				auto const res(m_sample_names.emplace(kv.first, sample_offset + kv.second));
+				always_assert(res.second, [&kv](){
+					std::cerr << "Sample '" << kv.first << "' occurs in more than one variant file." << std::endl;
+				});
+			}
+			sample_offset += part.reader->sample_count();
+		}
+
+		// The line numbers are those of the first partition.
+		m_lineno = m_partitions.front().reader->lineno();
+		m_last_header_lineno = m_lineno;
+
+		transient_variant var(sample_count());
+		using std::swap;
+		swap(m_current_variant, var);
+	}
+
+
+	void vcf_merging_reader::reset()
+	{
+		for (auto &part : m_partitions)
+		{
+			part.reader->reset();
+			part.cursor.reset(new vcf_reader_cursor(*part.reader));
+			part.variant_count = 0;
+		}
+
+		m_batch_pos = 0;
+		m_batch_count = 0;
+		m_at_end = false;
+		m_should_update_partitions = true;
+		reset_parser_state();
+	}
+
+
+	void vcf_merging_reader::set_parser_thread_count(std::size_t const count, std::size_t const min_split_line_length)
+	{
+		for (auto &part : m_partitions)
+			part.reader->set_parser_thread_count(count, min_split_line_length);
+	}
+
+
+	// Pass the parsing settings to the partitions, renumbering the requested samples.
+	void vcf_merging_reader::update_partitions()
+	{
+		for (auto &part : m_partitions)
+		{
+			auto &reader(*part.reader);
+			reader.set_parsed_fields(m_max_parsed_field);
+
+			if (m_skipped_sample_runs.empty())
+			{
+				reader.parse_all_samples();
+				continue;
+			}
+
+			auto const count(reader.sample_count());
+			std::vector <bool> mask(1 + count, false);
+			for (std::size_t i(1); i <= count; ++i)
+			{
+				auto const sample_no(part.sample_offset + i);
+				mask[i] = (sample_no <= m_last_parsed_sample && 0 == m_skipped_sample_runs[sample_no]);
+			}
+			reader.set_parsed_samples(mask);
+		}
+
+		m_should_update_partitions = false;
+	}
+
+
+	void vcf_merging_reader::read_partition_batch(void *ctx, std::size_t const idx)
+	{
+		auto &reader(*static_cast <vcf_merging_reader *>(ctx));
+		auto &part(reader.m_partitions[idx]);
+		if (part.variants.size() < reader.m_batch_size)
+			part.variants.resize(reader.m_batch_size);
+
+		part.variant_count = 0;
+		while (part.variant_count < reader.m_batch_size)
+		{
+			auto const *var(part.cursor->next());
+			if (!var)
+				break;
+
+			part.variants[part.variant_count++] = *var;
+		}
+	}
+
+
+	void vcf_merging_reader::read_batches()
+	{
+		auto queue(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+		dispatch_apply_f(m_partitions.size(), queue, this, &read_partition_batch);
+
+		m_batch_pos = 0;
+		m_batch_count = m_partitions.front().variant_count;
+		for (auto const &part : m_partitions)
+			always_assert(part.variant_count == m_batch_count, "The variant files have different numbers of records");
+
+		if (0 == m_batch_count)
+			m_at_end = true;
+	}
+
+
+	void vcf_merging_reader::check_record(std::size_t const idx) const
+	{
+		auto const &first(m_partitions.front().variants[idx]);
+		for (auto const &part : m_partitions)
+		{
+			auto const &var(part.variants[idx]);
+			always_assert(
+				var.pos() == first.pos() && var.chrom_id() == first.chrom_id() &&
+				(m_max_parsed_field < vcf_field::REF || var.ref() == first.ref()) &&
+				(m_max_parsed_field < vcf_field::ALT || var.alts() == first.alts()),
+				[&first](){
+					std::cerr << "The variant files differ on line " << first.lineno() << " of the first file." << std::endl;
+				}
+			);
+		}
+	}
+
+
+	void vcf_merging_reader::merge_record(std::size_t const idx)
+	{
+		check_record(idx);
+
+		// The strings refer to the first partition's copy, which is replaced in the next call to parse_records().
+		auto const &first(m_partitions.front().variants[idx]);
+		m_current_variant.reset();
+		m_current_variant.set_lineno(first.lineno());
+		m_current_variant.set_pos(first.pos());
+		m_current_variant.set_qual(first.qual());
+		m_current_variant.set_chrom_id(first.chrom_id());
+		m_current_variant.set_ref(first.ref());
+
+		{
+			std::size_t i(0);
+			for (auto const &id : first.ids())
+				m_current_variant.set_id(id, i++);
+		}
+
+		{
+			std::size_t i(0);
+			for (auto const &alt : first.alts())
+				m_current_variant.set_alt(alt, i++, false);
+		}
+
+		{
+			std::size_t i(0);
+			for (auto const svt : first.alt_sv_types())
+				m_current_variant.set_alt_sv_type(svt, i++);
+		}
+
+		if (m_max_parsed_field < vcf_field::ALL)
+			return;
+
+		// Find the last parsed sample in the combined numbering.
+		std::size_t last_sample_no(0);
+		std::size_t ploidy_stride(0);
+		for (auto const &part : m_partitions)
+		{
+			auto const &var(part.variants[idx]);
+			auto const count(var.sample_count());
+			if (1 < count)
+				last_sample_no = part.sample_offset + count - 1;
+			ploidy_stride = std::max(ploidy_stride, var.ploidy_stride());
+		}
+
+		if (0 == last_sample_no)
+			return;
+
+		m_current_variant.prepare_samples(last_sample_no, ploidy_stride);
+		for (auto const &part : m_partitions)
+		{
+			auto const &var(part.variants[idx]);
+			m_current_variant.copy_genotypes(var, part.sample_offset);
+
+			m_carriers = var.carriers();
+			for (auto &carrier : m_carriers)
+				carrier.sample_no += part.sample_offset;
+			m_current_variant.add_carriers(m_carriers, var.is_phased());
+		}
+	}
+
+
+	bool vcf_merging_reader::parse_records(callback_fn const &cb)
+	{
+		if (m_should_update_partitions)
+			update_partitions();
+
+		// Handle one batch per call like the other readers handle one buffer, so that
+		// the caller is done with the records before their strings are overwritten.
+		if (m_batch_pos == m_batch_count)
+		{
+			if (m_at_end)
+				return false;
+
+			read_batches();
+			if (m_at_end)
+				return false;
+		}
+
+		while (m_batch_pos < m_batch_count)
+		{
+			merge_record(m_batch_pos++);
+			if (!cb(m_current_variant))
+				break;
+		}
+
+		return true;
+	}
+}
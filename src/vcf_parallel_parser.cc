@@ -0,0 +1,167 @@
+/*
+ Copyright (c) 2017 Tuukka Norri
+ This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <vcf2multialign/util.hh>
+#include <vcf2multialign/vcf_parallel_parser.hh>
+
+
+namespace vcf2multialign {
+
+	vcf_parallel_parser::vcf_parallel_parser(vcf_reader &reader, std::size_t const thread_count, std::size_t const piece_size):
+		m_reader(&reader),
+		m_group(dispatch_group_create()),
+		m_piece_size(piece_size)
+	{
+		for (auto &win : m_windows)
+			win.pieces = std::vector <piece>(thread_count);	// The readers are not movable.
+	}
+
+
+	void vcf_parallel_parser::count_lines(void *ctx, std::size_t const idx)
+	{
+		auto &win(*static_cast <window *>(ctx));
+		auto &pc(win.pieces[idx]);
+		structural_index index(pc.begin, pc.end);
+		pc.line_count = index.count_newlines();
+
+		// The last line of the file may not end in a newline.
+		if (pc.begin != pc.end && '\n' != pc.end[-1])
+			++pc.line_count;
+	}
+
+
+	void vcf_parallel_parser::parse_piece(void *ctx, std::size_t const idx)
+	{
+		auto &win(*static_cast <window *>(ctx));
+		auto &pc(win.pieces[idx]);
+		bool const is_last(win.at_eof && idx + 1 == win.piece_count);
+
+		pc.variant_count = 0;
+		pc.reader.set_range(pc.begin, pc.end, (is_last ? pc.end : nullptr), pc.reader.lineno());
+		pc.reader.parse_range([&pc](transient_variant const &var) -> bool {
+			// Reuse the previously allocated variants.
+			if (pc.variant_count < pc.variants.size())
+				pc.variants[pc.variant_count] = var;
+			else
+				pc.variants.emplace_back(var);
+
+			++pc.variant_count;
+			return true;
+		});
+	}
+
+
+	void vcf_parallel_parser::parse_window(void *ctx)
+	{
+		auto &win(*static_cast <window *>(ctx));
+		auto queue(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+
+		// Count the lines first so that each reader starts from the correct line number.
+		dispatch_apply_f(win.piece_count, queue, &win, &count_lines);
+
+		auto lineno(win.first_lineno);
+		for (std::size_t i(0); i < win.piece_count; ++i)
+		{
+			auto &pc(win.pieces[i]);
+			pc.reader.m_lineno = lineno;
+			lineno += pc.line_count;
+		}
+		win.last_lineno = lineno;
+
+		dispatch_apply_f(win.piece_count, queue, &win, &parse_piece);
+	}
+
+
+	// Split the remaining part of the reader's buffer into pieces that end in newlines.
+	void vcf_parallel_parser::prepare_window(window &win, std::size_t const first_lineno)
+	{
+		auto &fsm(m_reader->m_fsm);
+		auto &index(m_reader->m_structural_index);
+
+		win.piece_count = 0;
+		win.first_lineno = first_lineno;
+		win.last_lineno = first_lineno;
+		while (win.piece_count < win.pieces.size() && fsm.p != fsm.pe)
+		{
+			auto &pc(win.pieces[win.piece_count++]);
+			pc.begin = fsm.p;
+			pc.end = fsm.pe;
+			if (m_piece_size < std::size_t(fsm.pe - fsm.p))
+			{
+				auto const nl(index.find_newline(fsm.p + m_piece_size));
+				if (nl)
+					pc.end = nl + 1;
+			}
+
+			pc.reader.copy_parsing_settings(*m_reader);
+			fsm.p = pc.end;
+		}
+
+		win.at_eof = (fsm.p == fsm.pe && fsm.eof == fsm.pe);
+	}
+
+
+	void vcf_parallel_parser::start_parsing(window &win)
+	{
+		m_is_parsing = true;
+		auto queue(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+		dispatch_group_async_f(*m_group, queue, &win, &parse_window);
+	}
+
+
+	void vcf_parallel_parser::wait_for_parsing()
+	{
+		if (m_is_parsing)
+		{
+			dispatch_group_wait(*m_group, DISPATCH_TIME_FOREVER);
+			m_is_parsing = false;
+		}
+	}
+
+
+	bool vcf_parallel_parser::parse(vcf_reader::callback_fn const &cb)
+	{
+		auto &fsm(m_reader->m_fsm);
+		bool const has_eof(fsm.eof);
+		window *current(&m_windows[0]);
+		window *next(&m_windows[1]);
+
+		prepare_window(*current, m_reader->m_lineno);
+		start_parsing(*current);
+		wait_for_parsing();
+
+		while (current->piece_count)
+		{
+			// Parse the next window while handling the current one.
+			prepare_window(*next, current->last_lineno);
+			if (next->piece_count)
+				start_parsing(*next);
+
+			for (std::size_t i(0); i < current->piece_count; ++i)
+			{
+				auto &pc(current->pieces[i]);
+				for (std::size_t j(0); j < pc.variant_count; ++j)
+				{
+					if (!cb(pc.variants[j]))
+					{
+						// Like in the serial parser, the rest of the buffer is not handled after a break.
+						wait_for_parsing();
+						m_reader->m_lineno = (next->piece_count ? next->last_lineno : current->last_lineno);
+						fsm.p = fsm.pe;
+						return true;
+					}
+				}
+			}
+
+			wait_for_parsing();
+			m_reader->m_lineno = current->last_lineno;
+
+			using std::swap;
+			swap(current, next);
+		}
+
+		return !has_eof;
+	}
+}
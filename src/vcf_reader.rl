@@ -3,8 +3,13 @@
  This code is licensed under MIT license (see LICENSE for details).
  */
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <vcf2multialign/util.hh>
+#include <vcf2multialign/vcf_parallel_parser.hh>
 #include <vcf2multialign/vcf_reader.hh>
+#include <vcf2multialign/vcf_wide_line_decoder.hh>
 
 
 %% machine vcf_parser;
@@ -99,11 +104,96 @@ namespace vcf2multialign { namespace detail {
 	{
 		return read_fields <t_emplace_back>(sv, std::string_view::npos, static_cast <char const *>(sv.data()), sep, count, res);
 	}
+	
+	
+	// Check that the four characters that start from p are of the form d|d or d/d followed by a tab or a newline.
+	inline bool is_diploid_gt(char const *p)
+	{
+		return (
+			std::uint8_t(p[0] - '0') < 10 &&
+			('|' == p[1] || '/' == p[1]) &&
+			std::uint8_t(p[2] - '0') < 10 &&
+			('\t' == p[3] || '\n' == p[3])
+		);
+	}
+	
+	
+	// Check two consecutive genotypes at once, the first of which should be followed by a tab.
+	// The characters are assumed to have been loaded in little-endian order.
+	inline bool is_diploid_gt_pair(std::uint64_t const word)
+	{
+		// Bytes 0, 2, 4 and 6 should be digits, i.e. 0x30 to 0x39.
+		if (0x0030003000300030ULL != (word & 0x00F000F000F000F0ULL))
+			return false;
+		if ((((word & 0x000F000F000F000FULL) + 0x0006000600060006ULL) & 0x0010001000100010ULL))
+			return false;
+		
+		auto const byte([word](unsigned int const idx) -> char { return (word >> (8 * idx)) & 0xff; });
+		auto const first_sep(byte(1));
+		auto const second_sep(byte(5));
+		auto const last(byte(7));
+		return (
+			('|' == first_sep || '/' == first_sep) &&
+			'\t' == byte(3) &&
+			('|' == second_sep || '/' == second_sep) &&
+			('\t' == last || '\n' == last)
+		);
+	}
 }}
 
 
 namespace vcf2multialign {
 	
+	bool vcf_region::parse(std::string const &str)
+	{
+		// Sequence names may contain colons, so use the last one as the separator.
+		auto const colon_pos(str.rfind(':'));
+		if (std::string::npos == colon_pos)
+		{
+			if (str.empty())
+				return false;
+			
+			chrom_id = str;
+			first_pos = 1;
+			last_pos = SIZE_MAX;
+			return true;
+		}
+		
+		if (0 == colon_pos)
+			return false;
+		
+		char const *range(str.c_str() + colon_pos + 1);
+		char *end(nullptr);
+		auto const first(std::strtoull(range, &end, 10));
+		if (end == range || 0 == first)
+			return false;
+		
+		std::size_t last(SIZE_MAX);
+		if ('-' == *end)
+		{
+			char const *last_str(end + 1);
+			if ('\0' != *last_str)
+			{
+				last = std::strtoull(last_str, &end, 10);
+				if (end == last_str || last < first)
+					return false;
+			}
+			else
+			{
+				end = const_cast <char *>(last_str);
+			}
+		}
+		
+		if ('\0' != *end)
+			return false;
+		
+		chrom_id = str.substr(0, colon_pos);
+		first_pos = first;
+		last_pos = last;
+		return true;
+	}
+	
+	
 	template <typename t_fnt>
 	struct vcf_reader::caller
 	{
@@ -122,12 +212,20 @@ namespace vcf2multialign {
 	};
 	
 	
-	template <int t_continue, int t_break>
-	int vcf_reader::check_max_field(vcf_field const field, int const target, callback_fn const &cb)
+	template <vcf_field t_max_field, vcf_field t_field, int t_continue, int t_break, typename t_callback>
+	int vcf_reader::check_max_field(int const target, t_callback const &cb)
 	{
-		if (field <= m_max_parsed_field)
+		if constexpr (t_field <= t_max_field)
 			return target;
-		
+		else
+			return end_record <t_continue, t_break>(cb);
+	}
+	
+	
+	// Skip the rest of the line and pass the current variant to the callback.
+	template <int t_continue, int t_break, typename t_callback>
+	int vcf_reader::end_record(t_callback const &cb)
+	{
 		skip_to_next_nl();
 		if (!cb(m_current_variant))
 			return t_break;
@@ -139,18 +237,15 @@ namespace vcf2multialign {
 	void vcf_reader::report_unexpected_character(char const *current_character, int const current_state)
 	{
 		std::cerr
-		<< "Unexpected character '" << *current_character << "' at " << m_lineno << ':' << (current_character - m_line_start)
+		<< "Unexpected character '" << *current_character << "' at " << original_lineno() << ':' << (current_character - m_line_start)
 		<< ", state " << current_state << '.' << std::endl;
 
+		// The buffer may contain the whole memory mapped file, so output only the current line.
+		std::string_view line(m_line_start, m_fsm.pe - m_line_start);
+		line = line.substr(0, line.find('\n'));
 		std::cerr
-		<< "** Buffer contents from the start:" << std::endl;
-		std::copy(m_buffer.cbegin(), m_buffer.cend(), std::ostream_iterator <char>(std::cerr));
-		std::cerr << std::endl;
-
-		std::string_view buffer_end(m_fsm.p, m_fsm.pe - m_fsm.p);
-		std::cerr
-		<< "** Buffer contents starting from m_fsm.p:" << std::endl
-		<< buffer_end << std::endl;
+		<< "** Current line:" << std::endl
+		<< line << std::endl;
 
 		abort();
 	}
@@ -158,22 +253,304 @@ namespace vcf2multialign {
 	
 	void vcf_reader::skip_to_next_nl()
 	{
-		std::string_view sv(m_fsm.p, m_fsm.pe - m_fsm.p);
-		auto const pos(sv.find('\n'));
-		always_assert(std::string_view::npos != pos, "Unable to find the next newline");
-		m_fsm.p += pos;
+		auto const nl(m_structural_index.find_newline(m_fsm.p));
+		always_assert(nl, "Unable to find the next newline");
+		m_fsm.p = nl;
+	}
+	
+	
+	// Called when m_fsm.p points to the separator before a sample.
+	// Make it point to the character before the separator that follows the
+	// count-th sample so that the separator is read next.
+	void vcf_reader::skip_samples(std::size_t const count)
+	{
+		auto const sep(m_structural_index.find_separator(m_fsm.p + 1, count));
+		always_assert(sep, "Unable to find the next separator");
+		m_fsm.p = sep - 1;
+	}
+	
+	
+	// Called when m_fsm.p points to the separator before the idx-th field of a sample.
+	// Make it point to the character before the next separator without tokenizing
+	// the field. If GT does not follow, skip the rest of the sample.
+	void vcf_reader::skip_sample_fields(std::size_t const idx)
+	{
+		char const *sep(nullptr);
+		if (SIZE_MAX == m_format_gt_idx || m_format_gt_idx < idx)
+		{
+			sep = m_structural_index.find_separator(m_fsm.p + 1, 1);
+			m_format_idx = m_format.size();
+		}
+		else
+		{
+			sep = m_structural_index.find_subfield_separator(m_fsm.p + 1);
+		}
+		
+		always_assert(sep, "Unable to find the next separator");
+		m_fsm.p = sep - 1;
+	}
+	
+	
+	// Called when m_fsm.p points to the first character of FORMAT.
+	// Make it point to the separator that follows the field. The keys are
+	// parsed only if the field differs from that of the previous record.
+	void vcf_reader::read_format()
+	{
+		char const *start(m_fsm.p);
+		auto const sep(m_structural_index.find_separator(start, 1));
+		always_assert(sep, "Unable to find the end of FORMAT");
+		m_fsm.p = sep;
+		
+		std::size_t const len(sep - start);
+		if (len == m_format_string.size() && 0 == std::memcmp(start, m_format_string.data(), len))
+			return;
+		
+		m_format_string.assign(start, len);
+		m_format.clear();
+		m_format_gt_idx = SIZE_MAX;
+		
+		std::string_view keys(start, len);
+		while (true)
+		{
+			auto const colon_pos(std::min(keys.find(':'), keys.size()));
+			auto const key(keys.substr(0, colon_pos));
+			
+			auto field(format_field::OTHER);
+			if ("GT" == key)
+			{
+				field = format_field::GT;
+				m_format_gt_idx = m_format.size();
+			}
+			else if ("DP" == key)	field = format_field::DP;
+			else if ("GQ" == key)	field = format_field::GQ;
+			else if ("PS" == key)	field = format_field::PS;
+			else if ("PQ" == key)	field = format_field::PQ;
+			else if ("MQ" == key)	field = format_field::MQ;
+			
+			m_format.emplace_back(field);
+			
+			if (colon_pos == keys.size())
+				break;
+			
+			keys.remove_prefix(1 + colon_pos);
+		}
+		
+		m_format_is_gt_only = (1 == m_format.size() && format_field::GT == m_format.front());
+	}
+	
+	
+	// Called when m_fsm.p points to the separator before a sample and FORMAT consists of GT only.
+	// Decode consecutive requested samples with diploid genotypes of single-digit alleles
+	// without the state machine. Return true if the rest of the line was handled, in which
+	// case m_fsm.p points to the newline. Otherwise m_fsm.p points to the separator before
+	// the next sample, which should be handled by the state machine.
+	bool vcf_reader::decode_diploid_genotypes()
+	{
+		char const *p(m_fsm.p);
+		char const *pe(m_fsm.pe);
+		auto sample_idx(m_sample_idx);
+		bool const has_mask(!m_skipped_sample_runs.empty());
+		bool retval(false);
+		
+		while (true)
+		{
+			auto const next_idx(1 + sample_idx);
+			if (has_mask && (m_last_parsed_sample < next_idx || m_skipped_sample_runs[next_idx]))
+				break;
+			
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			// Handle two samples with one load if possible.
+			if (9 <= pe - p)
+			{
+				auto const next_idx_2(1 + next_idx);
+				std::uint64_t word(0);
+				std::memcpy(&word, p + 1, sizeof(word));
+				if (
+					detail::is_diploid_gt_pair(word) &&
+					(!has_mask || (next_idx_2 <= m_last_parsed_sample && 0 == m_skipped_sample_runs[next_idx_2]))
+				)
+				{
+					m_current_variant.set_diploid_gt(word & 0xf, (word >> 16) & 0xf, next_idx, '|' == p[2]);
+					m_current_variant.set_diploid_gt((word >> 32) & 0xf, (word >> 48) & 0xf, next_idx_2, '|' == p[6]);
+					sample_idx = next_idx_2;
+					p += 8;
+					
+					if ('\n' == *p)
+					{
+						retval = true;
+						break;
+					}
+					
+					continue;
+				}
+			}
+#endif
+			
+			if (5 <= pe - p && detail::is_diploid_gt(p + 1))
+			{
+				m_current_variant.set_diploid_gt(p[1] - '0', p[3] - '0', next_idx, '|' == p[2]);
+				sample_idx = next_idx;
+				p += 4;
+				
+				if ('\n' == *p)
+				{
+					retval = true;
+					break;
+				}
+				
+				continue;
+			}
+			
+			break;
+		}
+		
+		m_fsm.p = p;
+		m_sample_idx = sample_idx;
+		return retval;
+	}
+	
+	
+	vcf_reader::vcf_reader() = default;
+	vcf_reader::~vcf_reader() = default;
+	
+	
+	vcf_reader::vcf_reader(vcf_input &input):
+		m_input(&input)
+	{
+	}
+	
+	
+	// Called when m_fsm.p points to the separator before the first sample and FORMAT consists of GT only.
+	// Return true if the samples were decoded, in which case m_fsm.p points to the newline.
+	bool vcf_reader::decode_wide_line()
+	{
+		// The whole line needs to be in the buffer.
+		auto const *nl(m_structural_index.find_newline(m_fsm.p));
+		if (! (nl && m_wide_line_decoder->min_line_length() <= std::size_t(nl - m_fsm.p)))
+			return false;
+		
+		if (!m_wide_line_decoder->decode(m_fsm.p, nl))
+			return false;
+		
+		m_fsm.p = nl;
+		return true;
+	}
+	
+	
+	void vcf_reader::set_parser_thread_count(std::size_t const count, std::size_t const min_split_line_length)
+	{
+		m_parallel_parser.reset();
+		m_wide_line_decoder.reset();
+		if (count <= 1)
+			return;
+		
+		if (min_split_line_length)
+		{
+			m_wide_line_decoder.reset(new vcf_wide_line_decoder(*this, count, min_split_line_length));
+			
+			// Try to fit several lines into the buffer.
+			if (m_input)
+				m_input->set_preferred_buffer_size(4 * min_split_line_length);
+			return;
+		}
+		
+		m_parallel_parser.reset(new vcf_parallel_parser(*this, count));
+		
+		// Buffered inputs read small amounts at a time by default.
+		if (m_input)
+			m_input->set_preferred_buffer_size(m_parallel_parser->window_size());
+	}
+	
+	
+	// Parse [p, pe) starting from the given line number, used by the parallel parser.
+	void vcf_reader::set_range(char const *p, char const *pe, char const *eof, std::size_t const lineno)
+	{
+		m_fsm.p = p;
+		m_fsm.pe = pe;
+		m_fsm.eof = eof;
+		m_lineno = lineno;
+		m_structural_index.set_range(p, pe);
+	}
+	
+	
+	void vcf_reader::copy_parsing_settings(vcf_reader const &other)
+	{
+		m_max_parsed_field = other.m_max_parsed_field;
+		m_skipped_sample_runs = other.m_skipped_sample_runs;
+		m_last_parsed_sample = other.m_last_parsed_sample;
+		m_line_numbers = other.m_line_numbers;
 	}
 	
 	
 	// Seek to the beginning of the records.
 	void vcf_reader::reset()
 	{
-		m_stream->clear();
-		m_stream->seekg(m_first_variant_offset);
+		m_input->reset_to_first_variant_offset();
+		reset_parser_state();
+	}
+	
+	
+	bool vcf_reader::set_first_variant(std::uint64_t const offset, std::size_t const lineno)
+	{
+		if (! (m_input && m_input->set_first_variant_offset(offset)))
+			return false;
+		
+		m_last_header_lineno = lineno - 1;
+		return true;
+	}
+	
+	
+	void vcf_reader::reset_parser_state()
+	{
 		m_lineno = m_last_header_lineno;
-		m_len = 0;
-		m_pos = 0;
-		m_fsm.eof = nullptr;
+		m_fsm = vcf_input_range();
+		m_structural_index.set_range(nullptr, nullptr);
+		m_region_started = false;
+		m_region_end_reached = false;
+	}
+	
+	
+	void vcf_reader::set_parsed_fields(vcf_field max_field)
+	{
+		// The region filter needs the position and the length of REF.
+		if (m_region.is_set() && max_field < vcf_field::REF)
+			max_field = vcf_field::REF;
+		
+		m_max_parsed_field = max_field;
+	}
+	
+	
+	void vcf_reader::set_parsed_samples(std::vector <bool> const &mask)
+	{
+		// Sample number 0 is reserved for the reference.
+		auto const count(1 + sample_count());
+		m_skipped_sample_runs.resize(count);
+		m_last_parsed_sample = 0;
+		
+		// Count the samples to be skipped before the next requested one so that they may be skipped at once.
+		std::size_t run_length(0);
+		for (std::size_t i(count - 1); 0 < i; --i)
+		{
+			if (i < mask.size() && mask[i])
+			{
+				run_length = 0;
+				if (0 == m_last_parsed_sample)
+					m_last_parsed_sample = i;
+			}
+			else
+			{
+				++run_length;
+			}
+			
+			m_skipped_sample_runs[i] = run_length;
+		}
+	}
+	
+	
+	void vcf_reader::set_region(vcf_region const &region)
+	{
+		m_region = region;
+		set_parsed_fields(m_max_parsed_field);
 	}
 	
 	
@@ -191,7 +568,7 @@ namespace vcf2multialign {
 	{
 		// For now, just skip lines that begin with "##".
 		std::string line;
-		while (std::getline(*m_stream, line))
+		while (m_input->getline(line))
 		{
 			++m_lineno;
 			if (! ('#' == line[0] && '#' == line[1]))
@@ -200,6 +577,17 @@ namespace vcf2multialign {
 			// FIXME: header handling goes here.
 		}
 		
+		read_column_header(line);
+		
+		// The input now points to the first variant.
+		m_input->store_first_variant_offset();
+		m_last_header_lineno = m_lineno;
+	}
+	
+	
+	// Read the sample names from the #CHROM line.
+	void vcf_reader::read_column_header(std::string const &line)
+	{
 		// Check for column headers.
 		{
 			auto const prefix(std::string("#CHROM"));
@@ -223,10 +611,6 @@ namespace vcf2multialign {
 			++i;
 		}
 		
-		// stream now points to the first variant.
-		m_first_variant_offset = m_stream->tellg();
-		m_last_header_lineno = m_lineno;
-		
 		// Instantiate a variant.
 		transient_variant var(sample_count());
 		using std::swap;
@@ -236,63 +620,176 @@ namespace vcf2multialign {
 	
 	void vcf_reader::fill_buffer()
 	{
-		// Copy the remainder to the beginning.
-		if (m_pos + 1 < m_len)
-		{
-			char *data_start(m_buffer.data());
-			char const *start(data_start + m_pos + 1);
-			char const *end(data_start + m_len);
-			std::copy(start, end, data_start);
-			m_len -= m_pos + 1;
-		}
-		else
-		{
-			m_len = 0;
-		}
-		
-		// Read until there's at least one newline in the buffer.
-		while (true)
-		{
-			char *data_start(m_buffer.data());
-			char *data(data_start + m_len);
+		m_input->fill_buffer(m_fsm);
+		m_structural_index.set_range(m_fsm.p, m_fsm.pe);
+	}
+	
+	
+	bool vcf_reader::parse(callback_fn &&callback)
+	{
+		return parse(callback);
+	}
+	
+	
+	bool vcf_reader::parse(callback_fn const &cb)
+	{
+		if (!m_region.is_set())
+			return parse_records(cb);
 		
-			std::size_t space(m_buffer.size() - m_len);
-			m_stream->read(data, space);
-			std::size_t const read_len(m_stream->gcount());
-			m_len += read_len;
+		if (m_region_end_reached)
+			return false;
 		
-			if (m_stream->eof())
+		auto const retval(parse_records([this, &cb](transient_variant const &var) -> bool {
+			if (var.chrom_id() != m_region.chrom_id)
 			{
-				m_pos = m_len;
-				m_fsm.p = data_start;
-				m_fsm.pe = data_start + m_len;
-				m_fsm.eof = m_fsm.pe;
-				return;
+				// Skip the records before the region's chromosome.
+				if (!m_region_started)
+					return true;
+				
+				m_region_end_reached = true;
+				return false;
 			}
-		
-			// Try to find the last newline in the new part.
-			std::string_view sv(data, read_len);
-			m_pos = sv.rfind('\n');
-			if (std::string_view::npos != m_pos)
+			
+			m_region_started = true;
+			auto const pos(var.pos());
+			if (m_region.last_pos < pos)
 			{
-				m_pos += (data - data_start);
-				m_fsm.p = data_start;
-				m_fsm.pe = m_fsm.p + m_pos + 1;
-				return;
+				m_region_end_reached = true;
+				return false;
 			}
+			
+			// Skip the records that are not completely inside the region.
+			if (pos < m_region.first_pos || m_region.last_pos < pos + var.ref().size() - 1)
+				return true;
+			
+			return cb(var);
+		}));
+		
+		return retval && !m_region_end_reached;
+	}
+	
+	
+	bool vcf_reader::parse(vcf_record_batch &batch, batch_callback_fn const &callback)
+	{
+		batch_builder builder;
+		builder.batch = &batch;
+		builder.callback = &callback;
+		batch.clear();
 		
-			m_buffer.resize(2 * m_buffer.size());
+		// Pass the records to the builder without std::function unless they need to be filtered.
+		auto const retval(m_region.is_set() ? parse(callback_fn(std::ref(builder))) : parse_records(builder));
+		
+		// Handle the remaining records before the buffer is refilled.
+		if (builder.should_stop || !builder.flush())
+			return false;
+		
+		return retval;
+	}
+	
+	
+	bool vcf_reader::batch_builder::operator()(transient_variant const &var) const
+	{
+		batch->push_back(var);
+		if (batch->is_full())
+			return flush();
+		
+		return true;
+	}
+	
+	
+	bool vcf_reader::batch_builder::flush() const
+	{
+		if (batch->size())
+		{
+			should_stop = !(*callback)(*batch);
+			batch->clear();
 		}
+		
+		return !should_stop;
 	}
 	
 	
-	bool vcf_reader::parse(callback_fn &&callback)
+	// Stop after the next record that passes the region filter.
+	bool vcf_reader::parse_next(transient_variant const *&dst)
 	{
-		return parse(callback);
+		// The serial parser continues from the next line after a break, unlike the parallel one.
+		dst = nullptr;
+		m_is_parsing_serially = true;
+		auto const retval(parse([&dst](transient_variant const &var) -> bool {
+			dst = &var;
+			return false;
+		}));
+		m_is_parsing_serially = false;
+		return retval;
 	}
 	
 	
-	bool vcf_reader::parse(callback_fn const &cb)
+	transient_variant const *vcf_reader_cursor::next()
+	{
+		while (!m_at_end)
+		{
+			if (m_should_fill_buffer)
+			{
+				m_reader->fill_buffer();
+				m_should_fill_buffer = false;
+			}
+			
+			transient_variant const *retval(nullptr);
+			auto const should_continue(m_reader->parse_next(retval));
+			if (retval)
+				return retval;
+			
+			// The buffer did not contain any more records.
+			m_at_end = !should_continue;
+			m_should_fill_buffer = true;
+		}
+		
+		return nullptr;
+	}
+	
+	
+	bool vcf_reader::parse_records(callback_fn const &cb)
+	{
+		// Use the parallel parser only if the buffer can be split into multiple pieces.
+		if (m_parallel_parser && !m_is_parsing_serially && 2 * m_parallel_parser->piece_size() < std::size_t(m_fsm.pe - m_fsm.p))
+			return m_parallel_parser->parse(cb);
+		
+		return parse_range(cb);
+	}
+	
+	
+	bool vcf_reader::parse_records(batch_builder &builder)
+	{
+		if (m_parallel_parser && 2 * m_parallel_parser->piece_size() < std::size_t(m_fsm.pe - m_fsm.p))
+			return m_parallel_parser->parse(std::ref(builder));
+		
+		return dispatch_parse_range(builder);
+	}
+	
+	
+	bool vcf_reader::parse_range(callback_fn const &cb)
+	{
+		return dispatch_parse_range(cb);
+	}
+	
+	
+	// Select the machine once per buffer instead of checking the field limit after each field.
+	// Only the levels used in the passes are specialized; parsing further than requested
+	// does not affect the callbacks.
+	template <typename t_callback>
+	bool vcf_reader::dispatch_parse_range(t_callback const &cb)
+	{
+		if (m_max_parsed_field <= vcf_field::REF)
+			return parse_range <vcf_field::REF>(cb);
+		else if (vcf_field::ALT == m_max_parsed_field)
+			return parse_range <vcf_field::ALT>(cb);
+		else
+			return parse_range <vcf_field::ALL>(cb);
+	}
+	
+	
+	template <vcf_field t_max_field, typename t_callback>
+	bool vcf_reader::parse_range(t_callback const &cb)
 	{
 		typedef variant_tpl <std::string_view> vc;
 		bool retval(true);
@@ -344,11 +841,9 @@ namespace vcf2multialign {
 					{
 						always_assert(m_format.size() == m_format_idx, "Not all fields present in the sample");
 						
+						// Consume the newline before breaking like end_record does.
 						if (!cb(m_current_variant))
-						{
-							fhold;
-							fbreak;
-						}
+							fgoto break_nl;
 						
 						fgoto main;
 					}
@@ -451,16 +946,6 @@ namespace vcf2multialign {
 			info_missing	= '.';
 			info			= info_missing | (info_part (';' info_part)*);
 			
-			# FIXME: handle other formats.
-			format_gt	= ('GT') @{ m_format.emplace_back(format_field::GT); };
-			format_dp	= ('DP') @{ m_format.emplace_back(format_field::DP); };
-			format_gq	= ('GQ') @{ m_format.emplace_back(format_field::GQ); };
-			format_ps	= ('PS') @{ m_format.emplace_back(format_field::PS); };
-			format_pq	= ('PQ') @{ m_format.emplace_back(format_field::PQ); };
-			format_mq	= ('MQ') @{ m_format.emplace_back(format_field::MQ); };
-			format_part	= format_gt | format_dp | format_gq | format_ps | format_pq | format_mq;
-			format		= ((format_part (':' format_part)*) >{ m_format.clear(); });
-			
 			# Genotype field in sample.
 			sample_gt_null_allele	= '.'
 				%{
@@ -484,13 +969,6 @@ namespace vcf2multialign {
 					m_idx = 0;
 				};
 			
-			# FIXME: add actions.
-			sample_dp		= (digit+);
-			sample_gq		= (digit+);
-			sample_ps		= (digit+);
-			sample_pq		= (digit+);
-			sample_mq		= (digit+);
-			
 			sep				= '\t';		# Field separator
 			ssep			= [\t\n:];	# Sample separator
 				
@@ -513,10 +991,10 @@ namespace vcf2multialign {
 					m_alt_sv = sv_type::NONE;
 					++m_lineno;
 					m_current_variant.reset();
-					m_current_variant.set_lineno(m_lineno);
+					m_current_variant.set_lineno(original_lineno());
 					m_line_start = fpc;
 					
-					fgoto *check_max_field <fentry(main_nl), fentry(break_nl)>(vcf_field::CHROM, fentry(chrom_id_f), cb);
+					fgoto *check_max_field <t_max_field, vcf_field::CHROM, fentry(main_nl), fentry(break_nl)>(fentry(chrom_id_f), cb);
 				}
 				$err(error)
 				$eof{ retval = false; };
@@ -525,7 +1003,7 @@ namespace vcf2multialign {
 			chrom_id_f :=
 				(chrom_id sep)
 				@{
-					fgoto *check_max_field <fentry(main_nl), fentry(break_nl)>(vcf_field::POS, fentry(pos_f), cb);
+					fgoto *check_max_field <t_max_field, vcf_field::POS, fentry(main_nl), fentry(break_nl)>(fentry(pos_f), cb);
 				}
 				$err(error);
 			
@@ -533,7 +1011,7 @@ namespace vcf2multialign {
 			pos_f :=
 				(pos sep)
 				@{
-					fgoto *check_max_field <fentry(main_nl), fentry(break_nl)>(vcf_field::ID, fentry(id_f), cb);
+					fgoto *check_max_field <t_max_field, vcf_field::ID, fentry(main_nl), fentry(break_nl)>(fentry(id_f), cb);
 				}
 				$err(error);
 			
@@ -541,7 +1019,7 @@ namespace vcf2multialign {
 			id_f :=
 				(id_rec sep)
 				@{
-					fgoto *check_max_field <fentry(main_nl), fentry(break_nl)>(vcf_field::REF, fentry(ref_f), cb);
+					fgoto *check_max_field <t_max_field, vcf_field::REF, fentry(main_nl), fentry(break_nl)>(fentry(ref_f), cb);
 				}
 				$err(error);
 			
@@ -549,7 +1027,7 @@ namespace vcf2multialign {
 			ref_f :=
 				(ref sep)
 				@{
-					fgoto *check_max_field <fentry(main_nl), fentry(break_nl)>(vcf_field::ALT, fentry(alt_f), cb);
+					fgoto *check_max_field <t_max_field, vcf_field::ALT, fentry(main_nl), fentry(break_nl)>(fentry(alt_f), cb);
 				}
 				$err(error);
 			
@@ -557,7 +1035,7 @@ namespace vcf2multialign {
 			alt_f :=
 				(alt sep)
 				@{
-					fgoto *check_max_field <fentry(main_nl), fentry(break_nl)>(vcf_field::QUAL, fentry(qual_f), cb);
+					fgoto *check_max_field <t_max_field, vcf_field::QUAL, fentry(main_nl), fentry(break_nl)>(fentry(qual_f), cb);
 				}
 				$err(error);
 			
@@ -565,7 +1043,7 @@ namespace vcf2multialign {
 			qual_f :=
 				(qual sep)
 				@{
-					fgoto *check_max_field <fentry(main_nl), fentry(break_nl)>(vcf_field::FILTER, fentry(filter_f), cb);
+					fgoto *check_max_field <t_max_field, vcf_field::FILTER, fentry(main_nl), fentry(break_nl)>(fentry(filter_f), cb);
 				}
 				$err(error);
 			
@@ -573,7 +1051,7 @@ namespace vcf2multialign {
 			filter_f :=
 				(filter sep)
 				@{
-					fgoto *check_max_field <fentry(main_nl), fentry(break_nl)>(vcf_field::INFO, fentry(info_f), cb);
+					fgoto *check_max_field <t_max_field, vcf_field::INFO, fentry(main_nl), fentry(break_nl)>(fentry(info_f), cb);
 				}
 				$err(error);
 			
@@ -581,60 +1059,76 @@ namespace vcf2multialign {
 			info_f :=
 				(info sep)
 				@{
-					fgoto *check_max_field <fentry(main_nl), fentry(break_nl)>(vcf_field::FORMAT, fentry(format_f), cb);
+					fgoto *check_max_field <t_max_field, vcf_field::FORMAT, fentry(main_nl), fentry(break_nl)>(fentry(format_f), cb);
 				}
 				$err(error);
 			
 			# FORMAT
-			# FIXME: try to skip parsing the field and compare to the existing format?
+			# Read the field without the state machine since it is usually identical in consecutive records.
 			format_f :=
-				(format sep)
+				any
 				@{
-					fgoto *check_max_field <fentry(main_nl), fentry(break_nl)>(vcf_field::ALL, fentry(sample_rec_f), cb);
+					read_format();
+					if ('\n' == fc)
+						fgoto *end_record <fentry(main_nl), fentry(break_nl)>(cb);
+					
+					fgoto *check_max_field <t_max_field, vcf_field::ALL, fentry(main_nl), fentry(break_nl)>(fentry(sample_rec_f), cb);
 				}
 				$err(error);
 			
 			# Sample fields
 			sample_gt_f := ((sample_gt) ssep @(end_sample_field)) $err(error);
-			sample_dp_f := ((sample_dp) ssep @(end_sample_field)) $err(error);
-			sample_gq_f := ((sample_gq) ssep @(end_sample_field)) $err(error);
-			sample_ps_f := ((sample_ps) ssep @(end_sample_field)) $err(error);
-			sample_pq_f := ((sample_pq) ssep @(end_sample_field)) $err(error);
-			sample_mq_f := ((sample_mq) ssep @(end_sample_field)) $err(error);
+			sample_skip_f := (ssep @(end_sample_field)) $err(error);
 			
 			# Sample record
+			# Not reached in the shallow passes, so avoid instantiating the sample handling in them.
 			sample_rec_f := "" >to{
-				always_assert(m_format_idx < m_format.size(), "Format does not match the sample");
-
-				// Sample index 0 is reserved for the reference.
-				++m_sample_idx;
-
-				// Parse according to the format field.
-				auto const idx(m_format_idx);
-				++m_format_idx;
-				auto const field(m_format[idx]);
-				switch (field)
+				if constexpr (t_max_field < vcf_field::ALL)
+					report_unexpected_character(fpc, fcurs);
+				else
 				{
-					case format_field::GT:
-						fgoto sample_gt_f;
-						
-					case format_field::DP:
-						fgoto sample_dp_f;
-						
-					case format_field::GQ:
-						fgoto sample_gq_f;
-						
-					case format_field::PS:
-						fgoto sample_ps_f;
+					always_assert(m_format_idx < m_format.size(), "Format does not match the sample");
+					
+					if (0 == m_format_idx)
+					{
+						// Handle the most common genotypes without the state machine.
+						// Decode the samples of long lines in parallel if requested.
+						if (m_format_is_gt_only && 0 == m_sample_idx && m_wide_line_decoder && decode_wide_line())
+							fgoto *end_record <fentry(main_nl), fentry(break_nl)>(cb);
 						
-					case format_field::PQ:
-						fgoto sample_pq_f;
+						if (m_format_is_gt_only && decode_diploid_genotypes())
+							fgoto *end_record <fentry(main_nl), fentry(break_nl)>(cb);
 						
-					case format_field::MQ:
-						fgoto sample_mq_f;
+						// Sample index 0 is reserved for the reference.
+						++m_sample_idx;
 						
-					default:
-						fail("Unexpected format value");
+						if (!m_skipped_sample_runs.empty())
+						{
+							// Stop after the last requested sample.
+							if (m_last_parsed_sample < m_sample_idx)
+								fgoto *end_record <fentry(main_nl), fentry(break_nl)>(cb);
+							
+							// Skip the samples that were not requested.
+							auto const skip_count(m_skipped_sample_runs[m_sample_idx]);
+							if (skip_count)
+							{
+								skip_samples(skip_count);
+								m_sample_idx += skip_count - 1;
+								m_format_idx = m_format.size();
+								fgoto sample_skip_f;
+							}
+						}
+					}
+
+					// Parse according to the format field.
+					auto const idx(m_format_idx);
+					++m_format_idx;
+					if (format_field::GT == m_format[idx])
+						fgoto sample_gt_f;
+					
+					// Only GT is used, so skip the other fields.
+					skip_sample_fields(idx);
+					fgoto sample_skip_f;
 				}
 			};
 			
@@ -656,11 +1150,7 @@ namespace vcf2multialign {
 						fgoto sample_rec_f;
 						
 						fgoto sample_gt_f;
-						fgoto sample_dp_f;
-						fgoto sample_gq_f;
-						fgoto sample_ps_f;
-						fgoto sample_pq_f;
-						fgoto sample_mq_f;
+						fgoto sample_skip_f;
 					}
 				};
 			
@@ -0,0 +1,318 @@
+/*
+ Copyright (c) 2017 Tuukka Norri
+ This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <tuple>
+#include <unistd.h>
+#include <vcf2multialign/util.hh>
+#include <vcf2multialign/vcf_sorter.hh>
+
+
+namespace {
+
+	std::uint64_t decode_u64(char const *data)
+	{
+		std::uint64_t retval(0);
+		for (std::size_t i(0); i < 8; ++i)
+			retval |= std::uint64_t(static_cast <unsigned char>(data[i])) << (8 * i);
+		return retval;
+	}
+
+
+	// Collect the output into larger writes.
+	class output_buffer
+	{
+	protected:
+		std::string	m_data;
+		int			m_fd{-1};
+
+	public:
+		explicit output_buffer(int const fd):
+			m_fd(fd)
+		{
+			m_data.reserve(1024 * 1024);
+		}
+
+		~output_buffer() { flush(); }
+
+		void flush()
+		{
+			vcf2multialign::always_assert(vcf2multialign::write_all(m_fd, m_data.data(), m_data.size()), "Unable to write to a temporary file");
+			m_data.clear();
+		}
+
+		void append(char const *data, std::size_t const len)
+		{
+			if (m_data.capacity() < m_data.size() + len)
+				flush();
+			m_data.append(data, len);
+		}
+
+		void append_u64(std::uint64_t const val)
+		{
+			char buffer[8];
+			for (std::size_t i(0); i < 8; ++i)
+				buffer[i] = char((val >> (8 * i)) & 0xff);
+			append(buffer, 8);
+		}
+	};
+}
+
+
+namespace vcf2multialign {
+
+	// Read the records of one run in order.
+	class vcf_sorter::run_reader
+	{
+	protected:
+		std::vector <char>	m_buffer;
+		std::string			m_line;
+		std::uint64_t		m_pos{0};
+		std::uint64_t		m_lineno{0};
+		int					m_fd{-1};
+		std::size_t			m_buffer_pos{0};
+		std::size_t			m_buffer_len{0};
+
+	protected:
+		bool read_bytes(char *dst, std::size_t len)
+		{
+			while (len)
+			{
+				if (m_buffer_pos == m_buffer_len)
+				{
+					auto const res(read(m_fd, m_buffer.data(), m_buffer.size()));
+					always_assert(-1 != res, "Unable to read from a temporary file");
+					if (0 == res)
+						return false;
+
+					m_buffer_pos = 0;
+					m_buffer_len = res;
+				}
+
+				auto const count(std::min(len, m_buffer_len - m_buffer_pos));
+				std::copy_n(m_buffer.data() + m_buffer_pos, count, dst);
+				m_buffer_pos += count;
+				dst += count;
+				len -= count;
+			}
+
+			return true;
+		}
+
+		std::uint64_t read_u64()
+		{
+			char data[8];
+			always_assert(read_bytes(data, 8), "Truncated temporary file");
+			return decode_u64(data);
+		}
+
+	public:
+		explicit run_reader(int const fd):
+			m_buffer(256 * 1024),
+			m_fd(fd)
+		{
+			always_assert(0 == lseek(fd, 0, SEEK_SET), "Unable to seek in a temporary file");
+		}
+
+		std::uint64_t pos() const { return m_pos; }
+		std::uint64_t lineno() const { return m_lineno; }
+		std::string const &line() const { return m_line; }
+
+		// Return false at the end of the run.
+		bool next()
+		{
+			char pos_data[8];
+			if (!read_bytes(pos_data, 8))
+				return false;
+
+			m_pos = decode_u64(pos_data);
+			m_lineno = read_u64();
+			m_line.resize(read_u64());
+			always_assert(read_bytes(m_line.data(), m_line.size()), "Truncated temporary file");
+			return true;
+		}
+	};
+
+
+	vcf_sorter::~vcf_sorter()
+	{
+		for (auto const &run : m_runs)
+			close(run.fd);
+	}
+
+
+	void vcf_sorter::sort_records()
+	{
+		// The line numbers are unique, so this is equivalent to a stable sort by POS.
+		std::sort(m_records.begin(), m_records.end(), [](record const &lhs, record const &rhs) {
+			return std::tie(lhs.pos, lhs.lineno) < std::tie(rhs.pos, rhs.lineno);
+		});
+	}
+
+
+	void vcf_sorter::write_run()
+	{
+		sort_records();
+
+		int const fd(open_temporary_file());
+		always_assert(-1 != fd, "Unable to create a temporary file");
+
+		{
+			output_buffer output(fd);
+			for (auto const &rec : m_records)
+			{
+				output.append_u64(rec.pos);
+				output.append_u64(rec.lineno);
+				output.append_u64(rec.length);
+				output.append(m_data.data() + rec.offset, rec.length);
+			}
+		}
+
+		m_data.clear();
+		m_records.clear();
+		add_run(fd, 0);
+	}
+
+
+	void vcf_sorter::add_run(int const fd, std::size_t const level)
+	{
+		m_runs.push_back(run{fd, level});
+
+		// Merge the last runs when they have the same level, so that each record is
+		// rewritten a logarithmic number of times. The newer runs are shorter, so
+		// the runs of the same level are at the end. Merge the last runs regardless
+		// of their levels if too many files would be open.
+		while (MERGE_FAN_IN <= m_runs.size())
+		{
+			auto const &first(m_runs[m_runs.size() - MERGE_FAN_IN]);
+			if (first.level != m_runs.back().level && m_runs.size() < MAX_RUN_COUNT)
+				break;
+
+			merge_last_runs();
+		}
+	}
+
+
+	void vcf_sorter::merge_last_runs()
+	{
+		auto const first(m_runs.size() - MERGE_FAN_IN);
+		auto const level(1 + m_runs[first].level);
+
+		int const fd(open_temporary_file());
+		always_assert(-1 != fd, "Unable to create a temporary file");
+
+		{
+			output_buffer output(fd);
+			merge_runs(first, [&output](run_reader const &reader){
+				auto const &line(reader.line());
+				output.append_u64(reader.pos());
+				output.append_u64(reader.lineno());
+				output.append_u64(line.size());
+				output.append(line.data(), line.size());
+			});
+		}
+
+		m_runs.push_back(run{fd, level});
+	}
+
+
+	// Pass the records of the runs starting from first to fn in order, then close the runs.
+	template <typename t_fn>
+	void vcf_sorter::merge_runs(std::size_t const first, t_fn &&fn)
+	{
+		std::vector <run_reader> readers;
+		readers.reserve(m_runs.size() - first);
+
+		// Order by position and then by line number, smallest first.
+		typedef std::tuple <std::uint64_t, std::uint64_t, std::size_t> queue_item;
+		std::priority_queue <queue_item, std::vector <queue_item>, std::greater <queue_item>> queue;
+
+		for (auto it(m_runs.cbegin() + first), end(m_runs.cend()); it != end; ++it)
+		{
+			auto &reader(readers.emplace_back(it->fd));
+			if (reader.next())
+				queue.emplace(reader.pos(), reader.lineno(), readers.size() - 1);
+		}
+
+		while (!queue.empty())
+		{
+			auto const idx(std::get <2>(queue.top()));
+			queue.pop();
+
+			auto &reader(readers[idx]);
+			fn(reader);
+
+			if (reader.next())
+				queue.emplace(reader.pos(), reader.lineno(), idx);
+		}
+
+		for (auto it(m_runs.cbegin() + first), end(m_runs.cend()); it != end; ++it)
+			close(it->fd);
+		m_runs.erase(m_runs.begin() + first, m_runs.end());
+	}
+
+
+	void vcf_sorter::sort(vcf_input &input, std::size_t const last_header_lineno, int const dst_fd, std::vector <std::size_t> &line_numbers)
+	{
+		// The header lines retain their numbers.
+		line_numbers.resize(1 + last_header_lineno);
+		std::iota(line_numbers.begin(), line_numbers.end(), 0);
+
+		std::string line;
+		std::size_t lineno(last_header_lineno);
+		while (input.getline(line))
+		{
+			++lineno;
+			if (line.empty())
+				continue;
+
+			if (!m_records.empty() && m_buffer_size < m_data.size() + line.size() + 1)
+				write_run();
+
+			auto const tab_pos(line.find('\t'));
+			record rec;
+			rec.pos = (std::string::npos == tab_pos ? 0 : strtoull(line.c_str() + tab_pos + 1, nullptr, 10));
+			rec.lineno = lineno;
+			rec.offset = m_data.size();
+			rec.length = 1 + line.size();
+			m_records.push_back(rec);
+
+			m_data += line;
+			m_data += '\n';
+		}
+
+		// Write the output directly if all the records fit into one run.
+		if (m_runs.empty())
+		{
+			sort_records();
+
+			output_buffer output(dst_fd);
+			for (auto const &rec : m_records)
+			{
+				output.append(m_data.data() + rec.offset, rec.length);
+				line_numbers.push_back(rec.lineno);
+			}
+
+			m_data.clear();
+			m_records.clear();
+			return;
+		}
+
+		if (!m_records.empty())
+			write_run();
+
+		output_buffer output(dst_fd);
+		merge_runs(0, [&output, &line_numbers](run_reader const &reader){
+			auto const &line(reader.line());
+			output.append(line.data(), line.size());
+			line_numbers.push_back(reader.lineno());
+		});
+	}
+}
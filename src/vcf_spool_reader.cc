@@ -0,0 +1,433 @@
+/*
+ Copyright (c) 2017 Tuukka Norri
+ This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <vcf2multialign/util.hh>
+#include <vcf2multialign/vcf_spool_reader.hh>
+
+
+namespace {
+
+	// The records are stored as follows, with the integers in little-endian order:
+	// record length excluding this field (8 bytes), line number, POS and QUAL (8 bytes each),
+	// CHROM and REF, the IDs, the ALTs and the ALT SV types each preceded by their count or length
+	// (4 bytes), the number of samples including the reference and the ploidy stride (4 bytes each),
+	// and if there are samples, the width of the genotype values (1 byte), the ploidy of each sample
+	// (1 byte), the genotype values of each sample and the phase bits of the values.
+	class record_writer
+	{
+	protected:
+		std::vector <char>	*m_data{nullptr};
+
+	public:
+		explicit record_writer(std::vector <char> &data):
+			m_data(&data)
+		{
+		}
+
+		void append_u8(std::uint8_t const val) { m_data->push_back(char(val)); }
+
+		void append_u16(std::uint16_t const val)
+		{
+			append_u8(val & 0xff);
+			append_u8(val >> 8);
+		}
+
+		void append_u32(std::uint32_t const val)
+		{
+			for (std::size_t i(0); i < 4; ++i)
+				append_u8((val >> (8 * i)) & 0xff);
+		}
+
+		void append_u64(std::uint64_t const val)
+		{
+			for (std::size_t i(0); i < 8; ++i)
+				append_u8((val >> (8 * i)) & 0xff);
+		}
+
+		void append_string(std::string_view const &str)
+		{
+			append_u32(str.size());
+			m_data->insert(m_data->end(), str.cbegin(), str.cend());
+		}
+
+		void write_u64(std::size_t const pos, std::uint64_t const val)
+		{
+			for (std::size_t i(0); i < 8; ++i)
+				(*m_data)[pos + i] = char((val >> (8 * i)) & 0xff);
+		}
+	};
+
+
+	class record_reader
+	{
+	protected:
+		unsigned char const	*m_p{nullptr};
+
+	public:
+		explicit record_reader(char const *p):
+			m_p(reinterpret_cast <unsigned char const *>(p))
+		{
+		}
+
+		char const *data() const { return reinterpret_cast <char const *>(m_p); }
+		void skip(std::size_t const len) { m_p += len; }
+
+		std::uint8_t read_u8() { return *m_p++; }
+
+		std::uint16_t read_u16()
+		{
+			std::uint16_t const retval(m_p[0] | (m_p[1] << 8));
+			m_p += 2;
+			return retval;
+		}
+
+		std::uint32_t read_u32()
+		{
+			std::uint32_t retval(0);
+			for (std::size_t i(0); i < 4; ++i)
+				retval |= std::uint32_t(m_p[i]) << (8 * i);
+			m_p += 4;
+			return retval;
+		}
+
+		std::uint64_t read_u64()
+		{
+			std::uint64_t retval(0);
+			for (std::size_t i(0); i < 8; ++i)
+				retval |= std::uint64_t(m_p[i]) << (8 * i);
+			m_p += 8;
+			return retval;
+		}
+
+		std::string_view read_string()
+		{
+			auto const len(read_u32());
+			std::string_view const retval(data(), len);
+			m_p += len;
+			return retval;
+		}
+	};
+
+
+	void encode_record(vcf2multialign::transient_variant const &var, std::vector <char> &dst)
+	{
+		auto const start(dst.size());
+		record_writer writer(dst);
+		writer.append_u64(0);	// Replaced with the length.
+		writer.append_u64(var.lineno());
+		writer.append_u64(var.pos());
+		writer.append_u64(var.qual());
+		writer.append_string(var.chrom_id());
+		writer.append_string(var.ref());
+
+		writer.append_u32(var.ids().size());
+		for (auto const &id : var.ids())
+			writer.append_string(id);
+
+		writer.append_u32(var.alts().size());
+		for (auto const &alt : var.alts())
+			writer.append_string(alt);
+
+		writer.append_u32(var.alt_sv_types().size());
+		for (auto const svt : var.alt_sv_types())
+			writer.append_u8(std::uint8_t(svt));
+
+		auto const sample_count(var.sample_count());
+		auto const stride(var.ploidy_stride());
+		writer.append_u32(sample_count);
+		writer.append_u32(stride);
+
+		if (1 < sample_count)
+		{
+			// Store the values in one byte each unless there are more ALTs.
+			auto const *codes(var.genotype_codes());
+			bool is_wide(false);
+			for (std::size_t i(1); i < sample_count; ++i)
+			{
+				auto const ploidy(var.sample(i).ploidy());
+				writer.append_u8(ploidy);
+				for (std::size_t j(0); j < ploidy; ++j)
+					is_wide |= (0xff < codes[i * stride + j]);
+			}
+
+			writer.append_u8(is_wide);
+			for (std::size_t i(1); i < sample_count; ++i)
+			{
+				auto const ploidy(var.sample(i).ploidy());
+				for (std::size_t j(0); j < ploidy; ++j)
+				{
+					auto const slot(i * stride + j);
+					if (is_wide)
+						writer.append_u16(codes[slot]);
+					else
+						writer.append_u8(codes[slot]);
+				}
+			}
+
+			// Pack the phase bits of the values in the same order.
+			auto const &phase_mask(var.phase_mask());
+			std::uint8_t phase_bits(0);
+			std::size_t bit_count(0);
+			for (std::size_t i(1); i < sample_count; ++i)
+			{
+				auto const ploidy(var.sample(i).ploidy());
+				for (std::size_t j(0); j < ploidy; ++j)
+				{
+					auto const slot(i * stride + j);
+					phase_bits |= ((phase_mask[slot / 64] >> (slot % 64)) & 0x1) << bit_count;
+					if (8 == ++bit_count)
+					{
+						writer.append_u8(phase_bits);
+						phase_bits = 0;
+						bit_count = 0;
+					}
+				}
+			}
+
+			if (bit_count)
+				writer.append_u8(phase_bits);
+		}
+
+		writer.write_u64(start, dst.size() - start - 8);
+	}
+
+
+	// Read len bytes unless the end of the file is reached first.
+	std::size_t read_at(int const fd, char *dst, std::size_t const len, std::uint64_t const offset)
+	{
+		std::size_t retval(0);
+		while (retval < len)
+		{
+			auto const res(pread(fd, dst + retval, len - retval, offset + retval));
+			if (-1 == res && EINTR == errno)
+				continue;
+
+			vcf2multialign::always_assert(-1 != res, "Unable to read from a temporary file");
+			if (0 == res)
+				break;
+
+			retval += res;
+		}
+
+		return retval;
+	}
+}
+
+
+namespace vcf2multialign {
+
+	vcf_spool_reader::vcf_spool_reader(std::unique_ptr <vcf_reader> &&source, std::size_t const read_size):
+		m_source(std::move(source)),
+		m_read_size(read_size),
+		m_spool_fd(open_temporary_file())
+	{
+		always_assert(-1 != m_spool_fd, "Unable to create a temporary file");
+	}
+
+
+	vcf_spool_reader::~vcf_spool_reader()
+	{
+		close(m_spool_fd);
+	}
+
+
+	void vcf_spool_reader::read_header()
+	{
+		m_source->read_header();
+
+		// Spool all the fields and samples regardless of the current pass.
+		m_source->set_parsed_fields(vcf_field::ALL);
+		m_source->parse_all_samples();
+
+		m_sample_names = m_source->sample_names();
+		m_lineno = m_source->lineno();
+		m_last_header_lineno = m_lineno;
+
+		transient_variant var(sample_count());
+		using std::swap;
+		swap(m_current_variant, var);
+	}
+
+
+	void vcf_spool_reader::reset()
+	{
+		// The source continues from where it was left.
+		m_buffer.clear();
+		m_buffer_pos = 0;
+		m_read_offset = 0;
+		reset_parser_state();
+	}
+
+
+	void vcf_spool_reader::set_parser_thread_count(std::size_t const count, std::size_t const min_split_line_length)
+	{
+		m_source->set_parser_thread_count(count, min_split_line_length);
+	}
+
+
+	void vcf_spool_reader::fill_buffer()
+	{
+		m_buffer.clear();
+		m_buffer_pos = 0;
+
+		if (m_read_offset < m_spool_size)
+			read_from_spool();
+		else if (!m_source_at_end)
+			read_from_source();
+	}
+
+
+	// Read the next complete records from the spool.
+	void vcf_spool_reader::read_from_spool()
+	{
+		m_buffer.resize(std::max <std::size_t>(m_read_size, 8));
+		while (true)
+		{
+			auto const len(read_at(m_spool_fd, m_buffer.data(), std::min <std::uint64_t>(m_buffer.size(), m_spool_size - m_read_offset), m_read_offset));
+
+			std::size_t end(0);
+			while (8 <= len - end)
+			{
+				auto const record_length(record_reader(m_buffer.data() + end).read_u64());
+				if (len - end - 8 < record_length)
+					break;
+
+				end += 8 + record_length;
+			}
+
+			if (end)
+			{
+				m_buffer.resize(end);
+				m_read_offset += end;
+				return;
+			}
+
+			// The next record did not fit.
+			always_assert(len == m_buffer.size(), "Truncated temporary file");
+			m_buffer.resize(2 * m_buffer.size());
+		}
+	}
+
+
+	// Parse the next range of the source and append its records to the spool.
+	void vcf_spool_reader::read_from_source()
+	{
+		m_source->fill_buffer();
+		auto const should_continue(m_source->parse([this](transient_variant const &var) -> bool {
+			encode_record(var, m_buffer);
+			return true;
+		}));
+		m_source_at_end = !should_continue;
+
+		always_assert(write_all(m_spool_fd, m_buffer.data(), m_buffer.size()), "Unable to write to a temporary file");
+		m_spool_size += m_buffer.size();
+		m_read_offset = m_spool_size;
+	}
+
+
+	// Fill m_current_variant with the fields and samples requested for the current pass.
+	void vcf_spool_reader::decode_record(char const *data)
+	{
+		record_reader reader(data);
+		m_current_variant.reset();
+		m_current_variant.set_lineno(reader.read_u64());
+		m_current_variant.set_pos(reader.read_u64());
+		m_current_variant.set_qual(reader.read_u64());
+		m_current_variant.set_chrom_id(reader.read_string());
+		m_current_variant.set_ref(reader.read_string());
+
+		{
+			auto const count(reader.read_u32());
+			for (std::size_t i(0); i < count; ++i)
+				m_current_variant.set_id(reader.read_string(), i);
+		}
+
+		{
+			auto const count(reader.read_u32());
+			for (std::size_t i(0); i < count; ++i)
+				m_current_variant.set_alt(reader.read_string(), i, false);
+		}
+
+		{
+			auto const count(reader.read_u32());
+			for (std::size_t i(0); i < count; ++i)
+				m_current_variant.set_alt_sv_type(sv_type(reader.read_u8()), i);
+		}
+
+		auto const sample_count(reader.read_u32());
+		auto const stride(reader.read_u32());
+		if (m_max_parsed_field < vcf_field::ALL || sample_count <= 1)
+			return;
+
+		// Leave the samples that were not requested empty like the parser does.
+		std::size_t last_sample_no(sample_count - 1);
+		bool const has_mask(!m_skipped_sample_runs.empty());
+		if (has_mask)
+			last_sample_no = std::min(last_sample_no, m_last_parsed_sample);
+
+		if (0 == last_sample_no)
+			return;
+
+		auto const *ploidies(reinterpret_cast <std::uint8_t const *>(reader.data()));
+		reader.skip(sample_count - 1);
+		bool const is_wide(reader.read_u8());
+
+		std::size_t value_count(0);
+		for (std::size_t i(1); i < sample_count; ++i)
+			value_count += ploidies[i - 1];
+
+		auto const *phase_bits(reinterpret_cast <std::uint8_t const *>(reader.data() + value_count * (is_wide ? 2 : 1)));
+
+		m_current_variant.prepare_samples(last_sample_no, stride);
+		m_carriers.clear();
+		bool is_phased(true);
+		std::size_t value_idx(0);
+		for (std::size_t i(1); i <= last_sample_no; ++i)
+		{
+			auto const ploidy(ploidies[i - 1]);
+			if (has_mask && m_skipped_sample_runs[i])
+			{
+				reader.skip(ploidy * (is_wide ? 2 : 1));
+				value_idx += ploidy;
+				continue;
+			}
+
+			for (std::size_t j(0); j < ploidy; ++j)
+			{
+				std::size_t const alt(is_wide ? reader.read_u16() : reader.read_u8());
+				bool const is_value_phased((phase_bits[value_idx / 8] >> (value_idx % 8)) & 0x1);
+				++value_idx;
+
+				m_current_variant.set_gt_in_range(alt, i, j, is_value_phased);
+				if (alt)
+					m_carriers.push_back(genotype_carrier{i, alt, uint8_t(j)});
+				if (j && !is_value_phased)
+					is_phased = false;
+			}
+		}
+
+		m_current_variant.add_carriers(m_carriers, is_phased);
+	}
+
+
+	bool vcf_spool_reader::parse_records(callback_fn const &cb)
+	{
+		while (m_buffer_pos < m_buffer.size())
+		{
+			record_reader reader(m_buffer.data() + m_buffer_pos);
+			auto const record_length(reader.read_u64());
+			m_buffer_pos += 8 + record_length;
+
+			decode_record(reader.data());
+			if (!cb(m_current_variant))
+				return true;
+		}
+
+		return !(m_source_at_end && m_read_offset == m_spool_size);
+	}
+}
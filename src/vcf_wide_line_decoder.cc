@@ -0,0 +1,208 @@
+/*
+ Copyright (c) 2017 Tuukka Norri
+ This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <dispatch/dispatch.h>
+#include <vcf2multialign/structural_index.hh>
+#include <vcf2multialign/util.hh>
+#include <vcf2multialign/vcf_reader.hh>
+#include <vcf2multialign/vcf_wide_line_decoder.hh>
+
+
+namespace vcf2multialign {
+
+	vcf_wide_line_decoder::vcf_wide_line_decoder(vcf_reader &reader, std::size_t const thread_count, std::size_t const min_line_length):
+		m_reader(&reader),
+		m_segments(4 * thread_count),
+		m_min_line_length(min_line_length)
+	{
+	}
+
+
+	// Split [sample_sep + 1, nl + 1) at tabs into segments of approximately equal length.
+	void vcf_wide_line_decoder::prepare_segments(char const *sample_sep, char const *nl)
+	{
+		char const *begin(1 + sample_sep);
+		char const *end(1 + nl);
+		std::size_t const length(end - begin);
+		std::size_t const target_count(std::max <std::size_t>(1, std::min(m_segments.size(), length / (64 * 1024))));
+
+		m_segment_count = 0;
+		while (begin != end)
+		{
+			auto &seg(m_segments[m_segment_count++]);
+			seg.begin = begin;
+			seg.end = end;
+
+			if (m_segment_count < target_count)
+			{
+				auto const *target(seg.begin + length / target_count);
+				auto const *tab(static_cast <char const *>(std::memchr(target, '\t', end - target)));
+				if (tab)
+					seg.end = tab + 1;
+			}
+
+			begin = seg.end;
+		}
+	}
+
+
+	void vcf_wide_line_decoder::count_samples(void *ctx, std::size_t const idx)
+	{
+		auto &decoder(*static_cast <vcf_wide_line_decoder *>(ctx));
+		auto &seg(decoder.m_segments[idx]);
+		structural_index index(seg.begin, seg.end);
+
+		// Each sample is followed by a tab except for the last one of the line.
+		seg.sample_count = index.count_tabs();
+		if ('\n' == seg.end[-1])
+			++seg.sample_count;
+	}
+
+
+	// Decode one GT value. On return p points to the character after the separator.
+	bool vcf_wide_line_decoder::decode_sample(segment &seg, char const *&p, std::size_t const sample_no)
+	{
+		auto &var(m_reader->m_current_variant);
+		std::size_t idx(0);
+		bool is_phased(false);
+		while (true)
+		{
+			std::size_t alt(0);
+			if ('.' == *p)
+			{
+				alt = NULL_ALLELE;
+				++p;
+			}
+			else if ('0' <= *p && *p <= '9')
+			{
+				do
+				{
+					alt *= 10;
+					alt += *p - '0';
+					++p;
+				} while ('0' <= *p && *p <= '9');
+			}
+			else
+			{
+				return false;
+			}
+
+			// Let the serial parser handle samples with higher ploidy than the previous ones.
+			if (var.ploidy_stride() <= idx)
+				return false;
+
+			var.set_gt_in_range(alt, sample_no, idx, is_phased);
+			if (alt)
+				seg.carriers.push_back(genotype_carrier{sample_no, alt, uint8_t(idx)});
+
+			switch (*p++)
+			{
+				case '|':
+					is_phased = true;
+					break;
+
+				case '/':
+					is_phased = false;
+					seg.is_phased = false;
+					break;
+
+				case '\t':
+				case '\n':
+					return true;
+
+				default:
+					return false;
+			}
+
+			++idx;
+		}
+	}
+
+
+	void vcf_wide_line_decoder::decode_segment(void *ctx, std::size_t const idx)
+	{
+		auto &decoder(*static_cast <vcf_wide_line_decoder *>(ctx));
+		auto const &reader(*decoder.m_reader);
+		auto const &skipped_sample_runs(reader.m_skipped_sample_runs);
+		auto &seg(decoder.m_segments[idx]);
+
+		seg.carriers.clear();
+		seg.is_phased = true;
+		seg.is_valid = true;
+
+		char const *p(seg.begin);
+		for (std::size_t i(0); i < seg.sample_count; ++i)
+		{
+			auto const sample_no(seg.first_sample_no + i);
+			if (decoder.m_last_sample_no < sample_no)
+				break;
+
+			// Skip the samples that were not requested.
+			if (! (skipped_sample_runs.empty() || 0 == skipped_sample_runs[sample_no]))
+			{
+				decoder.m_reader->m_current_variant.clear_gt_in_range(sample_no);
+				auto const *tab(static_cast <char const *>(std::memchr(p, '\t', seg.end - p)));
+				p = (tab ? tab + 1 : seg.end);
+				continue;
+			}
+
+			if (!decoder.decode_sample(seg, p, sample_no))
+			{
+				seg.is_valid = false;
+				return;
+			}
+		}
+	}
+
+
+	bool vcf_wide_line_decoder::decode(char const *sample_sep, char const *nl)
+	{
+		auto &reader(*m_reader);
+		auto &var(reader.m_current_variant);
+		always_assert(0 == reader.m_sample_idx, "The line should be split before its first sample");
+
+		prepare_segments(sample_sep, nl);
+
+		// Count the samples first so that each segment is decoded to the correct range.
+		auto queue(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+		dispatch_apply_f(m_segment_count, queue, this, &count_samples);
+
+		std::size_t sample_no(1);
+		for (std::size_t i(0); i < m_segment_count; ++i)
+		{
+			auto &seg(m_segments[i]);
+			seg.first_sample_no = sample_no;
+			sample_no += seg.sample_count;
+		}
+
+		m_last_sample_no = std::min(sample_no - 1, reader.m_last_parsed_sample);
+		if (0 == m_last_sample_no)
+			return true;
+
+		// Reserve the samples so that the segments may be decoded independently.
+		var.prepare_samples(m_last_sample_no);
+		dispatch_apply_f(m_segment_count, queue, this, &decode_segment);
+
+		for (std::size_t i(0); i < m_segment_count; ++i)
+		{
+			if (!m_segments[i].is_valid)
+			{
+				var.clear_samples();
+				return false;
+			}
+		}
+
+		for (std::size_t i(0); i < m_segment_count; ++i)
+		{
+			auto const &seg(m_segments[i]);
+			var.add_carriers(seg.carriers, seg.is_phased);
+		}
+
+		reader.m_sample_idx = sample_no - 1;
+		return true;
+	}
+}